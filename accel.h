@@ -0,0 +1,199 @@
+#ifndef __ACCEL_H__
+#define __ACCEL_H__
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "geometry.h"
+#include "scene.h"
+
+const uint32_t BVH_LEAF_SIZE = 4; // max spheres per leaf
+
+// bounding volume hierarchy node, nodes are stored depth first so the left child of an inner node
+// directly follows it. everything is an index, so the array can be written to disk and mapped back as is
+struct BVHNode {
+    float lo[3], hi[3];	// bounds
+    uint32_t first;		// leaf: first sphere, inner node: right child
+    uint32_t count;		// leaf: number of spheres, 0 for inner nodes
+};
+
+// spheres in BVH order as structure of arrays, with the hierarchy over them
+struct Accel {
+    std::vector<float> cx, cy, cz, radius;
+    std::vector<int> material;
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> slot;	// BVH order position of every sphere of the scene, by scene index
+};
+
+template <typename T> struct array_view {
+    const T *data = nullptr;
+    size_t count = 0;
+
+    array_view() = default;
+    array_view(const T *d, size_t n) : data(d), count(n) {}
+    array_view(const std::vector<T> &v) : data(v.data()), count(v.size()) {}
+    const T& operator[](const size_t i) const { return data[i]; }
+    size_t size() const { return count; }
+    const T *begin() const { return data; }
+    const T *end() const { return data + count; }
+};
+
+// everything the tracer reads. does not own the arrays, they live in a Scene + Accel or in a mapped snapshot
+struct SceneView {
+    array_view<Material> materials;
+    array_view<float> cx, cy, cz, radius;	// spheres, in BVH order
+    array_view<int> material;
+    array_view<BVHNode> nodes;
+    array_view<Plane> planes;
+    array_view<Light> lights;
+    Camera camera;
+    RenderSettings settings;
+};
+
+namespace bvh_builder {
+
+struct Builder {
+    std::vector<uint32_t> order;	// sphere indices, partitioned in place
+    std::vector<vec3> centroid;
+    const std::vector<Sphere> *spheres;
+    std::vector<BVHNode> *nodes;
+    std::map<size_t, uint32_t> subtree_size;	// filled by the first node_count() call, read only while building
+
+    // nodes in the subtree of n spheres, known in advance since the split is always at the median
+    uint32_t node_count(size_t n) {
+        if (n <= BVH_LEAF_SIZE) return 1;
+        auto it = subtree_size.find(n);
+        if (it != subtree_size.end()) return it->second;
+        uint32_t c = 1 + node_count(n / 2) + node_count(n - n / 2);
+        subtree_size[n] = c;
+        return c;
+    }
+
+    void build(uint32_t node, size_t begin, size_t end) {
+        BVHNode &nd = (*nodes)[node];
+        float lo[3] = {1e30f, 1e30f, 1e30f}, hi[3] = {-1e30f, -1e30f, -1e30f}, clo[3] = {1e30f, 1e30f, 1e30f}, chi[3] = {-1e30f, -1e30f, -1e30f};
+        for (size_t i = begin; i < end; i++) {
+            const Sphere &s = (*spheres)[order[i]];
+            const vec3 &c = centroid[order[i]];
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], s.center[a] - s.radius), hi[a] = std::max(hi[a], s.center[a] + s.radius);
+                clo[a] = std::min(clo[a], c[a]), chi[a] = std::max(chi[a], c[a]);
+            }
+        }
+        for (int a = 0; a < 3; a++) nd.lo[a] = lo[a], nd.hi[a] = hi[a];
+        if (end - begin <= BVH_LEAF_SIZE) {
+            nd.first = uint32_t(begin), nd.count = uint32_t(end - begin);
+            return;
+        }
+        int axis = 0; // split the longest axis of the centroid bounds at the median
+        for (int a = 1; a < 3; a++) if (chi[a] - clo[a] > chi[axis] - clo[axis]) axis = a;
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](uint32_t a, uint32_t b) { return centroid[a][axis] < centroid[b][axis]; });
+        uint32_t left = node + 1, right = left + node_count(mid - begin);
+        nd.first = right, nd.count = 0;
+        if (end - begin > (1 << 16)) { // big subtrees are built in parallel
+            #pragma omp task
+            build(left, begin, mid);
+            #pragma omp task
+            build(right, mid, end);
+            #pragma omp taskwait
+        } else {
+            build(left, begin, mid);
+            build(right, mid, end);
+        }
+    }
+};
+
+} // namespace bvh_builder
+
+inline Accel build_accel(const std::vector<Sphere> &spheres) {
+    Accel acc;
+    if (spheres.empty()) return acc;
+    bvh_builder::Builder b;
+    b.spheres = &spheres;
+    b.nodes = &acc.nodes;
+    b.order.resize(spheres.size());
+    b.centroid.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) b.order[i] = uint32_t(i), b.centroid[i] = spheres[i].center;
+    acc.nodes.resize(b.node_count(spheres.size()));
+    #pragma omp parallel
+    #pragma omp single
+    b.build(0, 0, spheres.size());
+
+    size_t n = spheres.size();
+    acc.cx.resize(n), acc.cy.resize(n), acc.cz.resize(n), acc.radius.resize(n), acc.material.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        const Sphere &s = spheres[b.order[i]];
+        acc.cx[i] = s.center.x, acc.cy[i] = s.center.y, acc.cz[i] = s.center.z;
+        acc.radius[i] = s.radius, acc.material[i] = s.material;
+    }
+    acc.slot.resize(n);
+    for (size_t i = 0; i < n; i++) acc.slot[b.order[i]] = uint32_t(i);
+    return acc;
+}
+
+// recompute the bounds of node and its subtree after spheres moved or changed radius, keeping the hierarchy
+inline void refit_accel(Accel &acc, uint32_t node = 0) {
+    if (acc.nodes.empty()) return;
+    BVHNode &nd = acc.nodes[node];
+    for (int a = 0; a < 3; a++) nd.lo[a] = 1e30f, nd.hi[a] = -1e30f;
+    auto grow = [&nd](const float *lo, const float *hi) {
+        for (int a = 0; a < 3; a++) nd.lo[a] = std::min(nd.lo[a], lo[a]), nd.hi[a] = std::max(nd.hi[a], hi[a]);
+    };
+    if (nd.count) {
+        for (uint32_t i = nd.first; i < nd.first + nd.count; i++) {
+            const float r = acc.radius[i];
+            const float lo[3] = {acc.cx[i] - r, acc.cy[i] - r, acc.cz[i] - r}, hi[3] = {acc.cx[i] + r, acc.cy[i] + r, acc.cz[i] + r};
+            grow(lo, hi);
+        }
+        return;
+    }
+    const uint32_t left = node + 1, right = nd.first;
+    refit_accel(acc, left), refit_accel(acc, right);
+    grow(acc.nodes[left].lo, acc.nodes[left].hi), grow(acc.nodes[right].lo, acc.nodes[right].hi);
+}
+
+// the leaf of every sphere (BVH order) and the parent of every node, the root being its own, for refit_sphere
+struct AccelPaths {
+    std::vector<uint32_t> leaf, parent;
+};
+
+inline AccelPaths accel_paths(const Accel &acc) {
+    AccelPaths p;
+    p.leaf.resize(acc.cx.size()), p.parent.assign(acc.nodes.size(), 0);
+    for (uint32_t n = 0; n < acc.nodes.size(); n++) {
+        const BVHNode &nd = acc.nodes[n];
+        if (nd.count)
+            for (uint32_t i = nd.first; i < nd.first + nd.count; i++) p.leaf[i] = n;
+        else p.parent[n + 1] = p.parent[nd.first] = n;
+    }
+    return p;
+}
+
+// refit_accel after only sphere i (BVH order) moved or changed radius: its leaf and the nodes above it, the
+// depth of the hierarchy rather than all of it
+inline void refit_sphere(Accel &acc, const AccelPaths &paths, uint32_t i) {
+    uint32_t n = paths.leaf[i];
+    refit_accel(acc, n);
+    while (n) {
+        n = paths.parent[n];
+        BVHNode &nd = acc.nodes[n];
+        const BVHNode &left = acc.nodes[n + 1], &right = acc.nodes[nd.first];
+        for (int a = 0; a < 3; a++) nd.lo[a] = std::min(left.lo[a], right.lo[a]), nd.hi[a] = std::max(left.hi[a], right.hi[a]);
+    }
+}
+
+inline SceneView make_view(const Scene &scene, const Accel &acc) {
+    SceneView v;
+    v.materials = scene.materials;
+    v.cx = acc.cx, v.cy = acc.cy, v.cz = acc.cz, v.radius = acc.radius, v.material = acc.material;
+    v.nodes = acc.nodes;
+    v.planes = scene.planes;
+    v.lights = scene.lights;
+    v.camera = scene.camera;
+    v.settings = scene.settings;
+    return v;
+}
+
+#endif //__ACCEL_H__
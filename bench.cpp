@@ -0,0 +1,405 @@
+// microbenchmarks of the geometry and intersection kernels, single threaded, on rays recorded from a render
+// of the benchmark scene. build: g++ -O3 -fopenmp bench.cpp -o bench
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "scene.h"
+#include "accel.h"
+#include "scenes.h"
+#include "tracer.h"
+#include "wide.h"
+#include "dispatch.h"
+
+// rays with the normal at their origin (zero for primary rays)
+struct RaySet {
+    std::vector<vec3> orig, dir, normal;
+
+    void add(const vec3 &o, const vec3 &d, const vec3 &n) { orig.push_back(o), dir.push_back(d), normal.push_back(n); }
+    size_t size() const { return orig.size(); }
+};
+
+// primary rays of a width x height image, and the reflection, refraction and shadow rays their first hits spawn
+struct RecordedRays {
+    RaySet primary, secondary, shadow;
+};
+
+RecordedRays record_rays(const SceneView &scene, int width, int height) {
+    RecordedRays r;
+    const RayGenerator raygen(scene.camera, width, height);
+    std::vector<float> dx(width), dy(width), dz(width);
+    for (int j = 0; j < height; j++) {
+        raygen.tile(0, j, width, 1, dx.data(), dy.data(), dz.data());
+        for (int i = 0; i < width; i++) {
+            vec3 dir = {dx[i], dy[i], dz[i]}, point, N;
+            Material material;
+            r.primary.add(raygen.origin, dir, vec3{0, 0, 0});
+            if (!scene_intersect(raygen.origin, dir, scene, point, N, material)) continue;
+            vec3 reflect_dir = reflect(dir, N);
+            r.secondary.add(reflect_dir * N < 0 ? point - N * 0.001 : point + N * 0.001, reflect_dir, N);
+            vec3 refract_dir = refract(dir, N, material.refractive_index).normalize();
+            r.secondary.add(refract_dir * N < 0 ? point - N * 0.001 : point + N * 0.001, refract_dir, N);
+            for (const Light &l : scene.lights) {
+                vec3 light_dir = (l.position - point).normalize();
+                r.shadow.add(light_dir * N < 0 ? point - N * 0.001 : point + N * 0.001, light_dir, N);
+            }
+        }
+    }
+    return r;
+}
+
+// ray file: "RTRAYS1\n", the three set sizes as uint64, then per ray 9 floats: origin, direction, normal
+void save_rays(const std::string &path, const RecordedRays &r) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot create " + path);
+    const RaySet *sets[3] = {&r.primary, &r.secondary, &r.shadow};
+    bool ok = fwrite("RTRAYS1\n", 8, 1, f) == 1;
+    for (const RaySet *s : sets) {
+        uint64_t n = s->size();
+        ok = ok && fwrite(&n, sizeof(n), 1, f) == 1;
+    }
+    for (const RaySet *s : sets) {
+        for (size_t i = 0; i < s->size() && ok; i++) {
+            const vec3 *v[3] = {&s->orig[i], &s->dir[i], &s->normal[i]};
+            float buf[9];
+            for (int k = 0; k < 3; k++) buf[3 * k] = v[k]->x, buf[3 * k + 1] = v[k]->y, buf[3 * k + 2] = v[k]->z;
+            ok = fwrite(buf, sizeof(buf), 1, f) == 1;
+        }
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) throw std::runtime_error("cannot write " + path);
+}
+
+RecordedRays load_rays(const std::string &path) {
+    std::string data = read_file(path);
+    RecordedRays r;
+    RaySet *sets[3] = {&r.primary, &r.secondary, &r.shadow};
+    uint64_t n[3];
+    if (data.size() < 32 || data.compare(0, 8, "RTRAYS1\n")) throw std::runtime_error(path + ": not a ray file");
+    memcpy(n, &data[8], sizeof(n));
+    if (data.size() != 32 + (n[0] + n[1] + n[2]) * 36) throw std::runtime_error(path + ": truncated ray file");
+    const char *p = &data[32];
+    for (int s = 0; s < 3; s++) {
+        for (uint64_t i = 0; i < n[s]; i++, p += 36) {
+            float buf[9];
+            memcpy(buf, p, sizeof(buf));
+            sets[s]->add(vec3{buf[0], buf[1], buf[2]}, vec3{buf[3], buf[4], buf[5]}, vec3{buf[6], buf[7], buf[8]});
+        }
+    }
+    return r;
+}
+
+// keeps the compiler from optimizing away a result
+template <typename T> inline void keep(const T &v) {
+    asm volatile("" : : "r"(&v) : "memory");
+}
+
+struct Result {
+    std::string name;
+    size_t ops;					// operations per repetition
+    std::vector<double> ns;		// ns per operation of each repetition
+    double median() const { return ns[ns.size() / 2]; }
+    double min() const { return ns.front(); }
+};
+
+struct Bench {
+    int warmup = 2, reps = 10;
+    std::string filter;
+    std::vector<Result> results;
+
+    // time f, which performs ops operations, over warmup + reps runs
+    template <typename F> void run(const std::string &name, size_t ops, F &&f) {
+        if (!ops || (!filter.empty() && name.find(filter) == std::string::npos)) return;
+        for (int i = 0; i < warmup; i++) f();
+        Result r{name, ops, {}};
+        for (int i = 0; i < reps; i++) {
+            auto t0 = std::chrono::steady_clock::now();
+            f();
+            auto t1 = std::chrono::steady_clock::now();
+            r.ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / ops);
+        }
+        std::sort(r.ns.begin(), r.ns.end());
+        printf("%-32s %10.2f ns/op  (min %8.2f)  %10.3f Mops/s\n", name.c_str(), r.median(), r.min(), 1e3 / r.median());
+        fflush(stdout);
+        results.push_back(r);
+    }
+};
+
+void write_json(const std::string &path, const Bench &b, const std::string &scene, const RecordedRays &rays) {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) throw std::runtime_error("cannot create " + path);
+    fprintf(f, "{\n  \"scene\": \"%s\",\n  \"rays\": {\"primary\": %zu, \"secondary\": %zu, \"shadow\": %zu},\n", scene.c_str(),
+        rays.primary.size(), rays.secondary.size(), rays.shadow.size());
+    fprintf(f, "  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"benchmarks\": [\n", b.warmup, b.reps);
+    for (size_t i = 0; i < b.results.size(); i++) {
+        const Result &r = b.results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.4f, \"ns_per_op_min\": %.4f, \"ops_per_sec\": %.1f, \"samples\": [",
+            r.name.c_str(), r.ops, r.median(), r.min(), 1e9 / r.median());
+        for (size_t k = 0; k < r.ns.size(); k++) fprintf(f, "%s%.4f", k ? ", " : "", r.ns[k]);
+        fprintf(f, "]}%s\n", i + 1 < b.results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f)) throw std::runtime_error("cannot write " + path);
+}
+
+// the scalar vec3 and vec4 of geometry.h before they were backed by SIMD registers, as the baseline of the vec
+// benchmarks
+namespace legacy {
+struct vec3 {
+    float& operator[](const size_t i) { return i==0 ? x : (1==i ? y : z); }
+    const float& operator[](const size_t i) const { return i==0 ? x : (1==i ? y : z); }
+    float norm() { return std::sqrt(x*x+y*y+z*z); }
+    vec3 & normalize(float l=1);
+    float x = 0, y = 0, z = 0;
+};
+struct vec4 {
+    float& operator[](const size_t i) { return data[i]; }
+    const float& operator[](const size_t i) const { return data[i]; }
+    float data[4] = {};
+};
+template <typename V, size_t DIM> V scale(const V &lhs, const float rhs) {
+    V ret;
+    for (size_t i = DIM; i--; ret[i] = lhs[i] * rhs);
+    return ret;
+}
+template <typename V, size_t DIM> float dot(const V& lhs, const V& rhs) {
+    float ret = 0;
+    for (size_t i = DIM; i--; ret += lhs[i] * rhs[i]);
+    return ret;
+}
+inline vec3 operator*(const vec3 &lhs, const float rhs) { return scale<vec3, 3>(lhs, rhs); }
+inline float operator*(const vec3 &lhs, const vec3 &rhs) { return dot<vec3, 3>(lhs, rhs); }
+inline float operator*(const vec4 &lhs, const vec4 &rhs) { return dot<vec4, 4>(lhs, rhs); }
+inline vec3 operator+(vec3 lhs, const vec3 &rhs) {
+    for (size_t i = 3; i--; lhs[i] += rhs[i]);
+    return lhs;
+}
+inline vec3 & vec3::normalize(float l) {
+    *this = (*this) * (l / norm());
+    return *this;
+}
+inline vec3 cross(vec3 v1, vec3 v2) {
+    return { v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x };
+}
+} // namespace legacy
+
+// the same loops on the vec types of geometry.h and on the legacy ones, prefix tells them apart
+template <typename V3, typename V4> void vec_benchmarks(Bench &b, const std::string &prefix, const std::vector<V3> &a, const std::vector<V3> &c) {
+    const size_t n = a.size();
+    std::vector<V3> out(n);
+    b.run(prefix + "vec3 add", n, [&] {
+        for (size_t i = 0; i < n; i++) out[i] = a[i] + c[i];
+        keep(out[n / 2]);
+    });
+    b.run(prefix + "vec3 scale", n, [&] {
+        for (size_t i = 0; i < n; i++) out[i] = a[i] * 1.5f;
+        keep(out[n / 2]);
+    });
+    b.run(prefix + "vec3 dot", n, [&] {
+        float sum = 0;
+        for (size_t i = 0; i < n; i++) sum += a[i] * c[i];
+        keep(sum);
+    });
+    b.run(prefix + "vec3 cross", n, [&] {
+        for (size_t i = 0; i < n; i++) out[i] = cross(a[i], c[i]);
+        keep(out[n / 2]);
+    });
+    b.run(prefix + "vec3 normalize", n, [&] {
+        for (size_t i = 0; i < n; i++) out[i] = (a[i] + c[i]).normalize();
+        keep(out[n / 2]);
+    });
+    b.run(prefix + "vec4 dot", n, [&] {
+        float sum = 0;
+        for (size_t i = 0; i < n; i++) sum += V4{a[i].x, a[i].y, a[i].z, 1} * V4{c[i].x, c[i].y, c[i].z, 0};
+        keep(sum);
+    });
+}
+
+void vec_benchmarks(Bench &b, const RaySet &rays) {
+    vec_benchmarks<vec3, vec4>(b, "", rays.dir, rays.orig);
+    std::vector<legacy::vec3> a(rays.dir.size()), c(rays.orig.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        a[i] = {rays.dir[i].x, rays.dir[i].y, rays.dir[i].z};
+        c[i] = {rays.orig[i].x, rays.orig[i].y, rays.orig[i].z};
+    }
+    vec_benchmarks<legacy::vec3, legacy::vec4>(b, "legacy ", a, c);
+}
+
+void ray_benchmarks(Bench &b, const SceneView &scene, const RecordedRays &rays) {
+    const RaySet *sets[3] = {&rays.primary, &rays.secondary, &rays.shadow};
+    const char *names[3] = {"primary", "secondary", "shadow"};
+
+    if (scene.cx.size()) {
+        const RaySet &r = rays.primary;
+        b.run("ray_sphere_intersect", r.size(), [&] {
+            int hits = 0;
+            for (size_t i = 0; i < r.size(); i++) { // every ray against one sphere, cycling through the scene
+                size_t s = i % scene.cx.size();
+                float t;
+                hits += ray_sphere_intersect(r.orig[i], r.dir[i], vec3{scene.cx[s], scene.cy[s], scene.cz[s]}, scene.radius[s], t);
+            }
+            keep(hits);
+        });
+    }
+
+    const RaySet &sec = rays.secondary;
+    b.run("reflect", sec.size(), [&] {
+        vec3 sum;
+        for (size_t i = 0; i < sec.size(); i++) sum = sum + reflect(sec.dir[i], sec.normal[i]);
+        keep(sum);
+    });
+    b.run("refract", sec.size(), [&] {
+        vec3 sum;
+        for (size_t i = 0; i < sec.size(); i++) sum = sum + refract(sec.dir[i], sec.normal[i], 1.5f);
+        keep(sum);
+    });
+
+    // the same kernels RT_LANES rays at a time
+    const std::string wide = " x" + std::to_string(RT_LANES);
+    auto packet = [](const std::vector<vec3> &v, size_t i) {
+        vec3xl p;
+        for (int k = 0; k < RT_LANES; k++) p.set_lane(k, v[i + k]);
+        return p;
+    };
+    if (scene.cx.size()) {
+        const RaySet &r = rays.primary;
+        const size_t n = r.size() / RT_LANES * RT_LANES;
+        std::vector<vec3xl> orig(n / RT_LANES), dir(n / RT_LANES);
+        for (size_t i = 0; i < n; i += RT_LANES) orig[i / RT_LANES] = packet(r.orig, i), dir[i / RT_LANES] = packet(r.dir, i);
+        b.run("ray_sphere_intersect" + wide, n, [&] {
+            int hits = 0;
+            for (size_t i = 0; i < orig.size(); i++) { // every packet against one sphere, cycling through the scene
+                size_t s = i % scene.cx.size();
+                vec3xl::lanes t;
+                hits += __builtin_popcount(lane_bits(ray_sphere_intersect(orig[i], dir[i],
+                    vec3xl::splat(vec3{scene.cx[s], scene.cy[s], scene.cz[s]}), vec3xl::lanes{} + scene.radius[s], t)));
+            }
+            keep(hits);
+        });
+    }
+    const size_t n = sec.size() / RT_LANES * RT_LANES;
+    std::vector<vec3xl> dir(n / RT_LANES), normal(n / RT_LANES);
+    for (size_t i = 0; i < n; i += RT_LANES) dir[i / RT_LANES] = packet(sec.dir, i), normal[i / RT_LANES] = packet(sec.normal, i);
+    b.run("reflect" + wide, n, [&] {
+        vec3xl sum = vec3xl::splat(vec3{0, 0, 0});
+        for (size_t i = 0; i < dir.size(); i++) sum = sum + reflect(dir[i], normal[i]);
+        keep(sum);
+    });
+    b.run("refract" + wide, n, [&] {
+        vec3xl sum = vec3xl::splat(vec3{0, 0, 0});
+        for (size_t i = 0; i < dir.size(); i++) sum = sum + refract(dir[i], normal[i], vec3xl::lanes{} + 1.5f);
+        keep(sum);
+    });
+
+    for (int s = 0; s < 3; s++) {
+        const RaySet &r = *sets[s];
+        if (!r.size()) continue;
+        b.run(std::string("scene_intersect ") + names[s], r.size(), [&] {
+            int hits = 0;
+            for (size_t i = 0; i < r.size(); i++) {
+                vec3 hit, N;
+                Material m;
+                hits += scene_intersect(r.orig[i], r.dir[i], scene, hit, N, m);
+            }
+            keep(hits);
+        });
+    }
+
+    const RaySet &p = rays.primary;
+    b.run("cast_ray primary", p.size(), [&] {
+        vec3 sum;
+        for (size_t i = 0; i < p.size(); i++) sum = sum + cast_ray(p.orig[i], p.dir[i], scene);
+        keep(sum);
+    });
+
+    // the same rays traced in double
+    std::vector<vec3d> orig_d(p.size()), dir_d(p.size());
+    for (size_t i = 0; i < p.size(); i++) orig_d[i] = vec_cast<double>(p.orig[i]), dir_d[i] = vec_cast<double>(p.dir[i]);
+    b.run("scene_intersect primary double", p.size(), [&] {
+        int hits = 0;
+        for (size_t i = 0; i < p.size(); i++) {
+            vec3d hit, N;
+            Material m;
+            hits += scene_intersect(orig_d[i], dir_d[i], scene, hit, N, m);
+        }
+        keep(hits);
+    });
+    b.run("cast_ray primary double", p.size(), [&] {
+        vec3d sum;
+        for (size_t i = 0; i < p.size(); i++) sum = sum + cast_ray(orig_d[i], dir_d[i], scene);
+        keep(sum);
+    });
+
+    // every instruction set variant of dispatch.h the CPU supports
+    size_t nk;
+    const Kernels *kernels = kernel_table(nk);
+    for (size_t k = 0; k < nk; k++) {
+        if (!kernels[k].supported()) continue;
+        b.run(std::string("scene_intersect primary ") + kernels[k].name, p.size(), [&] {
+            int hits = 0;
+            for (size_t i = 0; i < p.size(); i++) {
+                vec3 hit, N;
+                Material m;
+                hits += kernels[k].scene_intersect(p.orig[i], p.dir[i], scene, hit, N, m);
+            }
+            keep(hits);
+        });
+        b.run(std::string("cast_ray primary ") + kernels[k].name, p.size(), [&] {
+            vec3 sum;
+            for (size_t i = 0; i < p.size(); i++) sum = sum + kernels[k].cast_ray(p.orig[i], p.dir[i], scene, 0);
+            keep(sum);
+        });
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *usage = " [scene file | --generate spec] [--resolution WxH] [--rays file | --record file]"
+        " [--warmup n] [--reps n] [--filter name] [--json file]";
+    std::string scene_path, generator, rays_path, record_path, json_path;
+    int width = 320, height = 180;
+    Bench bench;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--generate" && has_value) generator = argv[++i];
+        else if (arg == "--resolution" && has_value && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) i++;
+        else if (arg == "--rays" && has_value) rays_path = argv[++i];
+        else if (arg == "--record" && has_value) record_path = argv[++i];
+        else if (arg == "--warmup" && has_value) bench.warmup = atoi(argv[++i]);
+        else if (arg == "--reps" && has_value) bench.reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--filter" && has_value) bench.filter = argv[++i];
+        else if (arg == "--json" && has_value) json_path = argv[++i];
+        else if (arg[0] != '-' && scene_path.empty()) scene_path = arg;
+        else {
+            std::cerr << "usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        Scene scene = !generator.empty() ? generate_scene(parse_generator_spec(generator))
+                    : !scene_path.empty() ? load_scene(scene_path) : stock_scene();
+        Accel accel = build_accel(scene.spheres);
+        SceneView view = make_view(scene, accel);
+        std::string scene_name = !generator.empty() ? generator : !scene_path.empty() ? scene_path : "stock";
+
+        // recorded rays make runs comparable across commits that change ray generation or shading
+        RecordedRays rays = !rays_path.empty() ? load_rays(rays_path) : record_rays(view, width, height);
+        if (!record_path.empty()) save_rays(record_path, rays);
+        printf("scene %s, %zu primary, %zu secondary, %zu shadow rays\n", scene_name.c_str(),
+            rays.primary.size(), rays.secondary.size(), rays.shadow.size());
+
+        vec_benchmarks(bench, rays.secondary.size() ? rays.secondary : rays.primary);
+        ray_benchmarks(bench, view, rays);
+        if (!json_path.empty()) write_json(json_path, bench, scene_name, rays);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+// quality versus speed: renders a reference image, then the scene with every combination of reflection depth,
+// samples per pixel and shadows, and reports render time and error against the reference with the settings
+// that are on the Pareto front of time and PSNR marked.
+// build: g++ -O3 -fopenmp bench_quality.cpp -o bench_quality
+// a compiler flag such as -ffast-math is evaluated by rendering the reference with a normal build (raytracer
+// --samples 16 ...) and passing it with --reference to a bench_quality built with the flag
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "scene.h"
+#include "accel.h"
+#include "scenes.h"
+#include "render.h"
+#include "image.h"
+
+struct Setting {
+    int depth, samples;
+    bool shadows;
+};
+
+struct Result {
+    Setting setting;
+    double ms;				// median render time
+    ImageError error;
+    bool pareto;			// no other setting is both faster and closer to the reference
+};
+
+// render with the given settings, the image is the median timed run's
+Image render_image(const SceneView &scene, double &ms, int reps) {
+    Framebuffer framebuffer;
+    std::vector<double> times;
+    for (int r = 0; r < reps; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        render(scene, framebuffer);
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::sort(times.begin(), times.end());
+    ms = times[times.size() / 2];
+    Image img;
+    img.width = scene.settings.width, img.height = scene.settings.height;
+    tonemap_quantize(framebuffer, img.rgb);
+    return img;
+}
+
+void write_json(FILE *f, const std::vector<Result> &results, double reference_ms) {
+    fprintf(f, "{\"reference_ms\": %.3f, \"settings\": [\n", reference_ms);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        fprintf(f, "  {\"depth\": %d, \"samples\": %d, \"shadows\": %s, \"ms\": %.3f, \"psnr\": %.4f, \"ssim\": %.6f, "
+            "\"max_abs\": %d, \"pareto\": %s}%s\n", r.setting.depth, r.setting.samples, r.setting.shadows ? "true" : "false",
+            r.ms, std::min(r.error.psnr, 999.), r.error.ssim, r.error.max_abs, r.pareto ? "true" : "false",
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+}
+
+int main(int argc, char **argv) {
+    const char *usage = " [scene file | --generate spec] [--resolution WxH] [--reference file.ppm | --reference-samples n]"
+        " [--depths a,b,..] [--samples a,b,..] [--shadows on,off] [--reps n] [--json file]";
+    std::string scene_path, generator, reference_path, json_path;
+    int width = 640, height = 360, reference_samples = 16, reps = 3;
+    std::vector<int> depths = {0, 1, 2, 4}, samples = {1, 2, 4, 8};
+    std::vector<bool> shadows = {true, false};
+
+    auto split = [](const std::string &s) {
+        std::vector<std::string> out;
+        for (size_t b = 0, e; b <= s.size(); b = e + 1) {
+            e = std::min(s.find(',', b), s.size());
+            if (e > b) out.push_back(s.substr(b, e - b));
+        }
+        return out;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--generate" && has_value) generator = argv[++i];
+        else if (arg == "--resolution" && has_value && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) i++;
+        else if (arg == "--reference" && has_value) reference_path = argv[++i];
+        else if (arg == "--reference-samples" && has_value) reference_samples = std::max(1, atoi(argv[++i]));
+        else if (arg == "--depths" && has_value) {
+            depths.clear();
+            for (const std::string &d : split(argv[++i])) depths.push_back(std::max(0, atoi(d.c_str())));
+        } else if (arg == "--samples" && has_value) {
+            samples.clear();
+            for (const std::string &n : split(argv[++i])) samples.push_back(std::max(1, atoi(n.c_str())));
+        } else if (arg == "--shadows" && has_value) {
+            shadows.clear();
+            for (const std::string &s : split(argv[++i])) shadows.push_back(s != "off");
+        }
+        else if (arg == "--reps" && has_value) reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--json" && has_value) json_path = argv[++i];
+        else if (arg[0] != '-' && scene_path.empty()) scene_path = arg;
+        else {
+            std::cerr << "usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+    if (depths.empty() || samples.empty() || shadows.empty() || width <= 0 || height <= 0) {
+        std::cerr << "usage: " << argv[0] << usage << std::endl;
+        return 1;
+    }
+
+    Scene scene;
+    Image reference;
+    try {
+        scene = !generator.empty() ? generate_scene(parse_generator_spec(generator))
+            : !scene_path.empty() ? load_scene(scene_path) : stock_scene();
+        if (!reference_path.empty()) reference = read_ppm(reference_path);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    Accel accel = build_accel(scene.spheres);
+    SceneView view = make_view(scene, accel);
+    view.settings.width = width, view.settings.height = height;
+
+    // the reference: the deepest swept depth, shadows, and many samples per pixel
+    double reference_ms = 0;
+    if (reference.rgb.empty()) {
+        view.settings.max_depth = *std::max_element(depths.begin(), depths.end());
+        view.settings.samples = reference_samples, view.settings.shadows = true;
+        reference = render_image(view, reference_ms, 1);
+        printf("reference: depth %d, %d samples, shadows, %.1f ms\n", view.settings.max_depth, reference_samples, reference_ms);
+    } else if (reference.width != width || reference.height != height) {
+        std::cerr << reference_path << " is " << reference.width << "x" << reference.height << ", render it at "
+            << width << "x" << height << " or pass --resolution" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (int d : depths)
+        for (int n : samples)
+            for (bool s : shadows) {
+                Result r = {{d, n, s}, 0, {}, false};
+                view.settings.max_depth = d, view.settings.samples = n, view.settings.shadows = s;
+                r.error = compare_images(render_image(view, r.ms, reps), reference);
+                results.push_back(r);
+            }
+
+    // sorted by time, a setting is on the front if it beats the PSNR of every faster one
+    std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) { return a.ms < b.ms; });
+    double best_psnr = -1;
+    for (Result &r : results) {
+        r.pareto = r.error.psnr > best_psnr;
+        best_psnr = std::max(best_psnr, r.error.psnr);
+    }
+
+    printf("%6s %8s %8s %10s %10s %9s %8s %7s\n", "depth", "samples", "shadows", "ms", "PSNR dB", "SSIM", "max err", "pareto");
+    for (const Result &r : results)
+        printf("%6d %8d %8s %10.1f %10.2f %9.5f %8d %7s\n", r.setting.depth, r.setting.samples, r.setting.shadows ? "on" : "off",
+            r.ms, r.error.psnr, r.error.ssim, r.error.max_abs, r.pareto ? "*" : "");
+
+    if (!json_path.empty()) {
+        FILE *f = fopen(json_path.c_str(), "w");
+        if (!f) {
+            std::cerr << "cannot create " << json_path << std::endl;
+            return 1;
+        }
+        write_json(f, results, reference_ms);
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+// end to end rendering benchmark: renders a fixed matrix of scenes, resolutions and thread counts, records
+// wall time, rays/s per ray type and peak RSS, and compares the throughput with a baseline run.
+// build: g++ -O3 -fopenmp bench_render.cpp -o bench_render
+#define RT_STATS // ray counters are needed for rays/s
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "geometry.h"
+#include "scene.h"
+#include "accel.h"
+#include "scenes.h"
+#include "stats.h"
+#include "render.h"
+
+struct Case {
+    std::string scene;	// "stock" or a generator spec
+    int width, height, threads;
+
+    std::string name() const {
+        return scene + "/" + std::to_string(width) + "x" + std::to_string(height) + "/t" + std::to_string(threads);
+    }
+};
+
+// filled in by the child process that renders the case
+struct Measurement {
+    double setup_ms, render_ms;		// scene generation + hierarchy build, and the median render time
+    TraceStats rays;				// of one render
+    long peak_rss_kb;				// of the whole child process
+    bool ok;
+};
+
+Measurement measure(const Case &c, int reps) {
+    Measurement m = {};
+    auto t0 = std::chrono::steady_clock::now();
+    Scene scene = c.scene == "stock" ? stock_scene() : generate_scene(parse_generator_spec(c.scene));
+    Accel accel = build_accel(scene.spheres);
+    SceneView view = make_view(scene, accel);
+    view.settings.width = c.width, view.settings.height = c.height;
+    m.setup_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    omp_set_num_threads(c.threads);
+    Framebuffer framebuffer;
+    std::vector<double> ms;
+    for (int r = 0; r < reps; r++) {
+        TraceStats stats;
+        auto t1 = std::chrono::steady_clock::now();
+        render(view, framebuffer, &stats);
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count());
+        m.rays = stats;
+    }
+    std::sort(ms.begin(), ms.end());
+    m.render_ms = ms[ms.size() / 2];
+    m.ok = true;
+    return m;
+}
+
+// run the case in a child process, so that each case gets its own peak RSS and starts from a clean heap
+Measurement measure_in_child(const Case &c, int reps) {
+    Measurement m = {};
+    int fd[2];
+    if (pipe(fd)) return m;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        Measurement r = {};
+        try {
+            r = measure(c, reps);
+        } catch (const std::exception &e) {
+            std::cerr << c.name() << ": " << e.what() << std::endl;
+        }
+        ssize_t n = write(fd[1], &r, sizeof(r));
+        _exit(n == sizeof(r) ? 0 : 1);
+    }
+    close(fd[1]);
+    if (pid < 0 || read(fd[0], &m, sizeof(m)) != sizeof(m)) m.ok = false;
+    close(fd[0]);
+    int status;
+    struct rusage ru;
+    if (pid > 0 && wait4(pid, &status, 0, &ru) == pid) m.peak_rss_kb = ru.ru_maxrss; // kilobytes on linux
+    return m;
+}
+
+double rate(uint64_t n, double ms) { return ms > 0 ? n / (ms * 1e-3) : 0; }
+
+// one case per line, so that read_baseline does not need a json parser
+void write_json(FILE *f, const std::vector<Case> &cases, const std::vector<Measurement> &ms) {
+    fprintf(f, "{\"cases\": [\n");
+    for (size_t i = 0; i < cases.size(); i++) {
+        const Case &c = cases[i];
+        const Measurement &m = ms[i];
+        const TraceStats &r = m.rays;
+        fprintf(f, "  {\"name\": \"%s\", \"scene\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"ok\": %s, "
+            "\"setup_ms\": %.3f, \"wall_ms\": %.3f, \"peak_rss_kb\": %ld, "
+            "\"rays\": {\"primary\": %llu, \"reflection\": %llu, \"refraction\": %llu, \"shadow\": %llu}, "
+            "\"rays_per_sec\": {\"primary\": %.0f, \"reflection\": %.0f, \"refraction\": %.0f, \"shadow\": %.0f, \"total\": %.0f}}%s\n",
+            c.name().c_str(), c.scene.c_str(), c.width, c.height, c.threads, m.ok ? "true" : "false",
+            m.setup_ms, m.render_ms, m.peak_rss_kb,
+            (unsigned long long)r.primary, (unsigned long long)r.reflection, (unsigned long long)r.refraction, (unsigned long long)r.shadow,
+            rate(r.primary, m.render_ms), rate(r.reflection, m.render_ms), rate(r.refraction, m.render_ms), rate(r.shadow, m.render_ms),
+            rate(r.rays(), m.render_ms), i + 1 < cases.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+}
+
+// case name -> total rays/s, from a file written by write_json
+std::map<std::string, double> read_baseline(const std::string &path) {
+    std::map<std::string, double> base;
+    std::string data = read_file(path);
+    size_t pos = 0;
+    while ((pos = data.find("{\"name\": \"", pos)) != std::string::npos) {
+        size_t name_begin = pos + 10, name_end = data.find('"', name_begin);
+        size_t total = data.find("\"total\": ", name_end), line_end = data.find('\n', name_end);
+        if (name_end == std::string::npos || total == std::string::npos || total > line_end) break;
+        base[data.substr(name_begin, name_end - name_begin)] = atof(data.c_str() + total + 9);
+        pos = line_end;
+    }
+    return base;
+}
+
+int main(int argc, char **argv) {
+    const char *usage = " [--scenes a,b,..] [--resolutions WxH,..] [--threads n,..] [--reps n] [--filter name]"
+        " [--json file] [--baseline file] [--tolerance fraction]";
+    // the fixed matrix: the stock scene and generated large ones, two resolutions, one thread and all of them
+    std::vector<std::string> scenes = {"stock", "uniform:100000:1", "clustered:1000000:1"};
+    std::vector<std::pair<int, int>> resolutions = {{480, 270}, {1280, 720}};
+    std::vector<int> threads = {1, omp_get_max_threads()};
+    std::string json_path, baseline_path, filter;
+    double tolerance = .05;
+    int reps = 3;
+
+    auto split = [](const std::string &s) {
+        std::vector<std::string> out;
+        for (size_t b = 0, e; b <= s.size(); b = e + 1) {
+            e = std::min(s.find(',', b), s.size());
+            if (e > b) out.push_back(s.substr(b, e - b));
+        }
+        return out;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scenes" && has_value) scenes = split(argv[++i]);
+        else if (arg == "--resolutions" && has_value) {
+            resolutions.clear();
+            for (const std::string &r : split(argv[++i])) {
+                int w, h;
+                if (sscanf(r.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0) resolutions.push_back({w, h});
+            }
+        } else if (arg == "--threads" && has_value) {
+            threads.clear();
+            for (const std::string &t : split(argv[++i])) threads.push_back(std::max(1, atoi(t.c_str())));
+        }
+        else if (arg == "--reps" && has_value) reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--filter" && has_value) filter = argv[++i];
+        else if (arg == "--json" && has_value) json_path = argv[++i];
+        else if (arg == "--baseline" && has_value) baseline_path = argv[++i];
+        else if (arg == "--tolerance" && has_value) tolerance = atof(argv[++i]);
+        else {
+            std::cerr << "usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+    std::vector<Case> cases;
+    for (const std::string &s : scenes)
+        for (auto r : resolutions)
+            for (int t : threads) {
+                Case c{s, r.first, r.second, t};
+                if (filter.empty() || c.name().find(filter) != std::string::npos) cases.push_back(c);
+            }
+
+    std::map<std::string, double> baseline;
+    try {
+        if (!baseline_path.empty()) baseline = read_baseline(baseline_path);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<Measurement> results;
+    int regressions = 0, failures = 0;
+    printf("%-36s %10s %10s %12s %10s %10s\n", "case", "setup ms", "wall ms", "Mrays/s", "peak MB", "vs base");
+    for (const Case &c : cases) {
+        Measurement m = measure_in_child(c, reps);
+        results.push_back(m);
+        double rps = rate(m.rays.rays(), m.render_ms);
+        std::string verdict;
+        auto b = baseline.find(c.name());
+        if (!m.ok) {
+            verdict = "FAILED";
+            failures++;
+        } else if (b != baseline.end() && b->second > 0) {
+            char buf[64];
+            double ratio = rps / b->second;
+            snprintf(buf, sizeof(buf), "%+.1f%%%s", (ratio - 1) * 100, ratio < 1 - tolerance ? " REGRESSION" : "");
+            verdict = buf;
+            regressions += ratio < 1 - tolerance;
+        }
+        printf("%-36s %10.1f %10.1f %12.3f %10.1f %10s\n", c.name().c_str(), m.setup_ms, m.render_ms, rps * 1e-6,
+            m.peak_rss_kb / 1024., verdict.c_str());
+        fflush(stdout);
+    }
+
+    if (!json_path.empty()) {
+        FILE *f = fopen(json_path.c_str(), "w");
+        if (!f) {
+            std::cerr << "cannot create " << json_path << std::endl;
+            return 1;
+        }
+        write_json(f, cases, results);
+        fclose(f);
+    }
+    if (regressions || failures) {
+        fprintf(stderr, "%d case(s) regressed by more than %.1f%%, %d failed\n", regressions, tolerance * 100, failures);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+#include <cmath>
+#include <vector>
+#include "geometry.h"
+
+// pinhole camera, orientation is given by a viewing direction and an up vector
+struct Camera {
+    vec3 position = {0, 0, 0};
+    vec3 forward = {0, 0, 1};	// viewing direction
+    vec3 up = {0, 1, 0};		// roughly up, only used to find the image plane axes. +y (+z looking along y) if parallel to forward
+    float hfov = PI / 2.f;		// horizontal field of view in radians
+    float aspect = 0;			// width / height of the image plane, <= 0 means same as the image
+};
+
+// primary ray generator for a width x height image. the direction of pixel (i, j) is
+//   normalize(col[i] + row[j]) with col[i] = right * x_i and row[j] = up * y_j + forward * z,
+// so everything except the add and the normalization is computed once per column and per row
+struct RayGenerator {
+    RayGenerator(const Camera &cam, int width, int height) : origin(cam.position),
+            col_x(width), col_y(width), col_z(width), row_x(height), row_y(height), row_z(height) {
+        vec3 f = cam.forward;
+        f.normalize();
+        vec3 r = cross(cam.up, f);	// right handed with +x right, +y up, +z forward
+        if (!(r.norm() > 1e-6f * cam.up.norm())) // up along the view direction (or zero): the world axis least along it
+            r = cross(std::abs(f.y) < .9f ? vec3{0, 1, 0} : vec3{0, 0, 1}, f);
+        r.normalize();
+        vec3 u = cross(f, r);
+        float aspect = cam.aspect > 0 ? cam.aspect : float(width) / height;
+        float z = width / (2.f * std::tan(cam.hfov / 2.f));	// distance to the image plane, in pixels
+        float sy = float(width) / height / aspect;				// vertical pixel size relative to horizontal
+        right = r, down = u * -sy;
+        for (int i = 0; i < width; i++) {
+            vec3 c = r * ((i + .5f) - width / 2.f);
+            col_x[i] = c.x, col_y[i] = c.y, col_z[i] = c.z;
+        }
+        for (int j = 0; j < height; j++) {
+            vec3 c = u * ((-(j + .5f) + height / 2.f) * sy) + f * z;
+            row_x[j] = c.x, row_y[j] = c.y, row_z[j] = c.z;
+        }
+    }
+
+    // write the normalized directions of the w x h tile at (x0, y0) in SoA form, row by row. the rays go
+    // through the pixel centers moved by (ox, oy) pixels, offsets in [-.5, .5) sample the pixel area
+    void tile(int x0, int y0, int w, int h, float *dx, float *dy, float *dz, float ox = 0, float oy = 0) const {
+        const vec3 offset = right * ox + down * oy;
+        for (int j = 0; j < h; j++) {
+            const float rx = row_x[y0 + j] + offset.x, ry = row_y[y0 + j] + offset.y, rz = row_z[y0 + j] + offset.z;
+            const float *cx = &col_x[x0], *cy = &col_y[x0], *cz = &col_z[x0];
+            float *out_x = dx + j * w, *out_y = dy + j * w, *out_z = dz + j * w; // this row of the directions
+            #pragma omp simd
+            for (int i = 0; i < w; i++) {
+                float x = cx[i] + rx, y = cy[i] + ry, z = cz[i] + rz;
+                float inv = 1.f / std::sqrt(x * x + y * y + z * z);
+                out_x[i] = x * inv, out_y[i] = y * inv, out_z[i] = z * inv;
+            }
+        }
+    }
+
+    int width() const { return int(col_x.size()); }
+
+    vec3 origin;
+    vec3 right, down;	// one pixel along the image axes
+    std::vector<float> col_x, col_y, col_z;
+    std::vector<float> row_x, row_y, row_z;
+};
+
+#endif //__CAMERA_H__
@@ -0,0 +1,545 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "geometry.h"
+#include "camera.h"
+#include "scene.h"
+#include "accel.h"
+#include "scenes.h"
+#include "snapshot.h"
+#include "render.h"
+#include "distributed.h"
+#include "gbuffer.h"
+#include "incremental.h"
+#include "scheduler.h"
+
+// Render daemon: a process that listens on a Unix domain socket and renders the requests of all its
+// connections at once on one pool of threads (scheduler.h), most urgent first. The scenes it built (parsed
+// scene and hierarchy) are kept in an LRU cache keyed by the content hash of their source, a scene file being
+// hashed again only when its size, modification time or inode change, and the threads stay alive between renders. A request is one line of words:
+//   scene <path> | generate <spec> | stock		the scene, stock if none is given
+//   camera <position x y z> <forward x y z> <up x y z> <hfov>	as in the scene format, replaces the scene's
+//   resolution <W>x<H>  depth <n>  samples <n>  shadows on|off  output <path>
+//   priority <n>		higher goes first and takes the threads from lower ones at their next tile, default 0
+//   deadline <ms>		from the arrival of the request, earlier goes first among requests of the same priority
+//   light <i> <x y z> <intensity>	replaces light i of the scene, or adds one if i is the number of lights
+//   color <material> <r g b>	replaces the diffuse color of the named material
+//   relight			shade the primary hits kept from the last relight request of the scene (gbuffer.h) if its
+//						camera, resolution and samples were the same, only lights and colors may differ
+//   sphere <i> <x y z> <radius>	moves sphere i of the scene (in the order of the scene file) and sets its radius, in
+//						the cached scene: the later requests for the scene see it too, until the scene is evicted
+//   incremental		render only the tiles that depend on spheres changed since the last incremental request of
+//						the scene (incremental.h), all of them if anything else changed. not with relight
+// and is answered with one line, "ok <total> <scene> <render> <write> hit|miss" with the times in ms followed
+// by the scheduling of the job as "wait <ms> tiles <n> preempted <n> mpix/s <x> deadline met|missed|none",
+// "gbuffer reused|recorded|off" and "incremental <rendered>/<tiles> saved <percent>%|off", or "error <message>".
+// "stats" answers with the latency percentiles of all requests so far and per priority,
+// "shutdown" stops the daemon once the requests in progress are answered. A connection can send any number of
+// requests, one after the other. A line longer than MAX_LINE is answered with an error and closes the connection.
+
+struct RenderRequest {
+    std::string scene_path, generator;	// neither means the stock scene
+    bool has_camera = false;
+    Camera camera;
+    int width = 0, height = 0, depth = -1, samples = 1;
+    bool shadows = true;
+    std::string output;					// empty: the scene's
+    int priority = 0;
+    double deadline_ms = 0;				// 0: none
+    std::vector<std::pair<int, Light>> lights;	// index, light
+    std::vector<std::pair<std::string, vec3>> colors;	// material name, diffuse color
+    std::vector<std::pair<int, Sphere>> spheres;		// scene index, center and radius
+    bool relight = false;
+    bool incremental = false;
+};
+
+// throws std::runtime_error on a malformed request
+inline RenderRequest parse_request(const std::string &line) {
+    RenderRequest r;
+    std::istringstream in(line);
+    std::string key;
+    auto fail = [](const std::string &what) { throw std::runtime_error("malformed '" + what + "'"); };
+    while (in >> key) {
+        if (key == "scene") {
+            if (!(in >> r.scene_path)) fail(key);
+        } else if (key == "generate") {
+            if (!(in >> r.generator)) fail(key);
+        } else if (key == "stock") {
+            r.scene_path.clear(), r.generator.clear();
+        } else if (key == "camera") {
+            Camera &c = r.camera;
+            float fov;
+            if (!(in >> c.position.x >> c.position.y >> c.position.z >> c.forward.x >> c.forward.y >> c.forward.z
+                    >> c.up.x >> c.up.y >> c.up.z >> fov)) fail(key);
+            c.hfov = fov * PI / 180.f;
+            r.has_camera = true;
+        } else if (key == "resolution") {
+            std::string wh;
+            if (!(in >> wh) || sscanf(wh.c_str(), "%dx%d", &r.width, &r.height) != 2 || r.width <= 0 || r.height <= 0) fail(key);
+        } else if (key == "depth") {
+            if (!(in >> r.depth) || r.depth < 0) fail(key);
+        } else if (key == "samples") {
+            if (!(in >> r.samples) || r.samples < 1) fail(key);
+        } else if (key == "shadows") {
+            std::string v;
+            if (!(in >> v) || (v != "on" && v != "off")) fail(key);
+            r.shadows = v == "on";
+        } else if (key == "output") {
+            if (!(in >> r.output)) fail(key);
+        } else if (key == "priority") {
+            if (!(in >> r.priority)) fail(key);
+        } else if (key == "deadline") {
+            if (!(in >> r.deadline_ms) || r.deadline_ms <= 0) fail(key);
+        } else if (key == "light") {
+            int i;
+            Light l;
+            if (!(in >> i >> l.position.x >> l.position.y >> l.position.z >> l.intensity) || i < 0) fail(key);
+            r.lights.push_back({i, l});
+        } else if (key == "color") {
+            std::string name;
+            vec3 c;
+            if (!(in >> name >> c.x >> c.y >> c.z)) fail(key);
+            r.colors.push_back({name, c});
+        } else if (key == "relight") {
+            r.relight = true;
+        } else if (key == "sphere") {
+            int i;
+            Sphere sp;
+            if (!(in >> i >> sp.center.x >> sp.center.y >> sp.center.z >> sp.radius) || i < 0 || !(sp.radius > 0)) fail(key);
+            r.spheres.push_back({i, sp});
+        } else if (key == "incremental") {
+            r.incremental = true;
+        } else {
+            throw std::runtime_error("unknown request word '" + key + "'");
+        }
+    }
+    if (r.relight && r.incremental) throw std::runtime_error("relight and incremental do not combine");
+    return r;
+}
+
+// what stat says of a scene file, a file with the same stamp is taken to have the same content
+struct FileStamp {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    timespec modified;
+
+    static bool of(const std::string &path, FileStamp &s) {
+        struct stat st;
+        if (stat(path.c_str(), &st)) return false;
+        s = {st.st_dev, st.st_ino, st.st_size, st.st_mtim};
+        return true;
+    }
+    bool operator==(const FileStamp &o) const {
+        return device == o.device && inode == o.inode && size == o.size && modified.tv_sec == o.modified.tv_sec
+            && modified.tv_nsec == o.modified.tv_nsec;
+    }
+};
+
+struct CachedScene {
+    uint64_t hash;
+    std::vector<std::pair<std::string, FileStamp>> sources;	// scene files found to hold it, as they were then
+    std::shared_future<void> built;	// ready once the fields below are, or with the exception the build threw
+    Scene scene;
+    mutable Accel accel;	// its spheres are edited in place by sphere requests
+    SceneView view;		// into scene and accel, which stay in place as long as the entry lives
+    mutable std::shared_mutex edit_lock;	// shared by the renders of the scene, exclusive while spheres are edited
+    mutable AccelPaths paths;				// of accel, made by the first sphere edit
+    mutable SphereEdits edits;
+    mutable uint64_t generation = 0;		// of the geometry, one more at every sphere edit (the G-buffer's key)
+    mutable std::mutex gbuffer_lock;	// held by the relight request rendering through gbuffer
+    mutable GBuffer gbuffer;
+    mutable std::mutex incremental_lock;	// held by the incremental request rendering through incremental
+    mutable IncrementalRender incremental;
+};
+
+// the most recently used scenes, up to capacity of them. an evicted scene lives on until the last render
+// using it ends
+struct SceneCache {
+    size_t capacity = 4;
+    std::list<std::shared_ptr<CachedScene>> entries;	// most recently used first, with the ones being built
+    uint64_t hits = 0, misses = 0;
+
+    // the scene of the request, built if it is not cached. called with lock (of the cache) held, which is
+    // released while the scene file is read and while a missing scene is built: the entry is published first,
+    // unbuilt, and the requests for the same scene in the meantime wait for it without the lock. a scene file
+    // is only read and hashed if its stamp is not the one of a cached scene loaded from it. throws
+    // std::runtime_error if the scene cannot be loaded
+    std::shared_ptr<const CachedScene> get(const RenderRequest &r, bool &hit, std::unique_lock<std::mutex> &lock) {
+        std::string text;
+        uint64_t hash = 0;
+        GeneratorSpec spec;
+        FileStamp stamp;
+        bool stamped = false;
+        auto found = entries.end();
+        if (!r.generator.empty()) {
+            spec = parse_generator_spec(r.generator);
+            std::string key = "generate " + to_string(spec) + " v" + std::to_string(GENERATOR_VERSION);
+            hash = content_hash(key.data(), key.size());
+        } else if (!r.scene_path.empty()) {
+            lock.unlock();
+            stamped = FileStamp::of(r.scene_path, stamp); // before reading, an edit during the read changes it
+            lock.lock();
+            for (auto it = entries.begin(); it != entries.end() && stamped && found == entries.end(); ++it)
+                for (const auto &f : (*it)->sources)
+                    if (f.first == r.scene_path && f.second == stamp) found = it;
+            if (found == entries.end()) {
+                lock.unlock();
+                text = read_file(r.scene_path); // hashing the content notices edits the stamp may not show
+                hash = content_hash(text.data(), text.size());
+                lock.lock();
+            }
+        } else {
+            static const uint64_t stock_hash = content_hash(stock_scene());
+            hash = stock_hash;
+        }
+        // the file now holds the scene of c
+        auto remember = [&](CachedScene &c) {
+            if (!stamped) return;
+            auto f = std::find_if(c.sources.begin(), c.sources.end(),
+                [&](const std::pair<std::string, FileStamp> &p) { return p.first == r.scene_path; });
+            if (f == c.sources.end()) c.sources.push_back({r.scene_path, stamp});
+            else f->second = stamp;
+        };
+        for (auto it = entries.begin(); it != entries.end() && found == entries.end(); ++it)
+            if ((*it)->hash == hash) found = it;
+        if (found != entries.end()) {
+            remember(**found);
+            entries.splice(entries.begin(), entries, found);
+            hits++, hit = true;
+            std::shared_ptr<CachedScene> c = entries.front();
+            lock.unlock();
+            std::shared_future<void> built = c->built;
+            try {
+                built.get(); // rethrows what its build threw
+            } catch (...) {
+                lock.lock();
+                throw;
+            }
+            lock.lock();
+            return c;
+        }
+        misses++, hit = false;
+        if (entries.size() >= std::max<size_t>(capacity, 1)) entries.pop_back();
+        auto c = std::make_shared<CachedScene>();
+        std::promise<void> done;
+        c->hash = hash;
+        c->incremental.edits = &c->edits;
+        c->gbuffer.generation = &c->generation;
+        remember(*c);
+        c->built = done.get_future().share();
+        entries.push_front(c);
+        lock.unlock();
+        try {
+            c->scene = !r.generator.empty() ? generate_scene(spec)
+                : !r.scene_path.empty() ? parse_scene(text.data(), text.size(), r.scene_path) : stock_scene();
+            c->accel = build_accel(c->scene.spheres);
+            c->view = make_view(c->scene, c->accel);
+        } catch (...) {
+            done.set_exception(std::current_exception());
+            lock.lock();
+            entries.remove(c); // the next request tries again
+            throw;
+        }
+        done.set_value();
+        lock.lock();
+        return c;
+    }
+};
+
+// per request times in ms, for the percentiles
+struct LatencyLog {
+    std::vector<double> total, scene, render;
+    std::map<int, std::vector<double>> by_priority;	// total
+    std::map<int, int> missed_deadlines;			// by priority
+
+    static double percentile(std::vector<double> v, double p) {
+        if (v.empty()) return 0;
+        std::sort(v.begin(), v.end());
+        return v[std::min(v.size() - 1, size_t(p * (v.size() - 1) + .5))];
+    }
+    std::string summary(const SceneCache &cache) const {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%zu requests, total ms p50 %.2f p95 %.2f max %.2f, render ms p50 %.2f, scene ms p50 %.2f,"
+            " cache %llu hits %llu misses", total.size(), percentile(total, .5), percentile(total, .95), percentile(total, 1),
+            percentile(render, .5), percentile(scene, .5), (unsigned long long)cache.hits, (unsigned long long)cache.misses);
+        std::string out = buf;
+        for (auto it = by_priority.rbegin(); it != by_priority.rend(); ++it) {
+            auto m = missed_deadlines.find(it->first);
+            snprintf(buf, sizeof(buf), "; priority %d: %zu requests, total ms p50 %.2f p95 %.2f, %d missed deadlines", it->first,
+                it->second.size(), percentile(it->second, .5), percentile(it->second, .95), m == missed_deadlines.end() ? 0 : m->second);
+            out += buf;
+        }
+        return out;
+    }
+};
+
+// what the connections of a daemon share
+struct DaemonState {
+    std::mutex lock;		// cache and log, not held while a scene is built
+    SceneCache cache;
+    LatencyLog log;
+    TileScheduler scheduler;
+
+    DaemonState(size_t cache_size, int threads) : scheduler(threads) { cache.capacity = cache_size; }
+};
+
+// render one request line, the answer without the line feed
+inline std::string serve_request(const std::string &line, DaemonState &state) {
+    typedef std::chrono::steady_clock clock;
+    auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    auto t0 = clock::now();
+    try {
+        const RenderRequest r = parse_request(line);
+        bool hit;
+        std::shared_ptr<const CachedScene> c;
+        {
+            std::unique_lock<std::mutex> guard(state.lock);
+            c = state.cache.get(r, hit, guard);
+        }
+        auto t1 = clock::now();
+        SceneView view = c->view;
+        if (r.has_camera) view.camera = r.camera;
+        if (r.width) view.settings.width = r.width, view.settings.height = r.height;
+        if (r.depth >= 0) view.settings.max_depth = r.depth;
+        if (!r.output.empty()) view.settings.output = r.output;
+        view.settings.samples = r.samples, view.settings.shadows = r.shadows;
+        // the light and color edits live in copies, the cached scene keeps its own
+        std::vector<Light> lights(view.lights.begin(), view.lights.end());
+        std::vector<Material> materials(view.materials.begin(), view.materials.end());
+        for (const auto &l : r.lights) {
+            if (size_t(l.first) > lights.size()) throw std::runtime_error("no light " + std::to_string(l.first));
+            if (size_t(l.first) == lights.size()) lights.push_back(l.second);
+            else lights[l.first] = l.second;
+        }
+        for (const auto &m : r.colors) {
+            const std::vector<std::string> &names = c->scene.material_names;
+            auto it = std::find(names.begin(), names.end(), m.first);
+            if (it == names.end()) throw std::runtime_error("no material " + m.first);
+            materials[it - names.begin()].diffuse_color = m.second;
+        }
+        view.lights = lights, view.materials = materials;
+        for (const auto &e : r.spheres)
+            if (size_t(e.first) >= c->accel.slot.size()) throw std::runtime_error("no sphere " + std::to_string(e.first));
+        if (!r.spheres.empty()) { // in place once the renders reading the spheres are done, refitting the path of each
+            std::unique_lock<std::shared_mutex> edit_guard(c->edit_lock);
+            Accel &acc = c->accel;
+            if (c->paths.leaf.size() != acc.cx.size()) c->paths = accel_paths(acc);
+            for (const auto &e : r.spheres) {
+                const uint32_t j = acc.slot[e.first];
+                acc.cx[j] = e.second.center.x, acc.cy[j] = e.second.center.y, acc.cz[j] = e.second.center.z;
+                acc.radius[j] = e.second.radius;
+                refit_sphere(acc, c->paths, j);
+                c->edits.add(j);
+            }
+            c->generation++;
+        }
+        std::shared_lock<std::shared_mutex> render_guard(c->edit_lock); // the spheres stay put until the render is done
+        std::unique_lock<std::mutex> state_guard; // of the G-buffer or the incremental render, one request at a time
+        if (r.relight) state_guard = std::unique_lock<std::mutex>(c->gbuffer_lock);
+        if (r.incremental) state_guard = std::unique_lock<std::mutex>(c->incremental_lock);
+        const double deadline_ms = r.deadline_ms > 0 ? std::max(r.deadline_ms - ms(t0, t1), 1e-3) : 0;
+        std::shared_ptr<RenderJob> job = state.scheduler.submit(view, r.priority, deadline_ms, r.relight ? &c->gbuffer : nullptr,
+            r.incremental ? &c->incremental : nullptr);
+        state.scheduler.wait(*job);
+        if (r.incremental) c->incremental.finish(job->framebuffer);
+        if (state_guard) state_guard.unlock();
+        render_guard.unlock();
+        auto t2 = clock::now();
+        // on this thread, the pool is busy with the tiles of other requests
+        std::vector<unsigned char> rgb(job->framebuffer.size() * 3);
+        active_kernels().tonemap_pixels(job->framebuffer.data(), rgb.data(), job->framebuffer.size());
+        if (!write_ppm(view.settings.output, rgb, view.settings.width, view.settings.height))
+            throw std::runtime_error("cannot write " + view.settings.output);
+        auto t3 = clock::now();
+        const JobStats &js = job->stats;
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            LatencyLog &log = state.log;
+            log.total.push_back(ms(t0, t3)), log.scene.push_back(ms(t0, t1)), log.render.push_back(ms(t1, t2));
+            log.by_priority[r.priority].push_back(ms(t0, t3));
+            if (!js.deadline_met) log.missed_deadlines[r.priority]++;
+        }
+        char buf[384];
+        snprintf(buf, sizeof(buf), "ok %.3f %.3f %.3f %.3f %s wait %.3f tiles %d preempted %d mpix/s %.3f deadline %s gbuffer %s", ms(t0, t3),
+            ms(t0, t1), ms(t1, t2), ms(t2, t3), hit ? "hit" : "miss", js.wait_ms, js.tiles, js.preemptions,
+            js.mpixels_per_s(view.settings.width, view.settings.height), !js.has_deadline ? "none" : js.deadline_met ? "met" : "missed",
+            !r.relight ? "off" : js.relit ? "reused" : "recorded");
+        std::string answer = buf;
+        const int total = js.tiles + js.tiles_kept;
+        if (r.incremental) snprintf(buf, sizeof(buf), " incremental %d/%d saved %.1f%%", js.tiles, total, total ? 100. * js.tiles_kept / total : 0.);
+        else snprintf(buf, sizeof(buf), " incremental off");
+        return answer + buf;
+    } catch (const std::exception &e) {
+        return std::string("error ") + e.what();
+    }
+}
+
+inline bool make_socket_address(const std::string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+const size_t MAX_LINE = 65536;	// bytes of a request or an answer with its line feed
+
+// one line without the line feed from fd, through the buffer pending, false at the end of the connection or,
+// with too_long set, once MAX_LINE bytes came without a line feed
+inline bool read_line(int fd, std::string &pending, std::string &line, bool *too_long = nullptr) {
+    if (too_long) *too_long = false;
+    for (size_t searched = 0;;) {
+        size_t eol = pending.find('\n', searched);
+        if (eol != std::string::npos) {
+            line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            return true;
+        }
+        searched = pending.size();
+        if (pending.size() >= MAX_LINE) {
+            if (too_long) *too_long = true;
+            return false;
+        }
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        pending.append(buf, size_t(n));
+    }
+}
+
+// serve requests on the socket at path with threads render threads until a shutdown request, the exit status
+inline int run_daemon(const std::string &path, size_t cache_size, int threads) {
+    sockaddr_un addr;
+    if (!make_socket_address(path, addr)) {
+        fprintf(stderr, "socket path too long: %s\n", path.c_str());
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str()); // a socket left by a daemon that did not shut down
+    if (fd < 0 || bind(fd, (const sockaddr *)&addr, sizeof(addr)) || listen(fd, 16)) {
+        fprintf(stderr, "cannot listen on %s: %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    fprintf(stderr, "listening on %s, %d render threads\n", path.c_str(), threads);
+    DaemonState state(cache_size, threads);
+    std::mutex connections_lock;
+    std::set<int> open;					// connections being served
+    std::list<std::pair<std::thread, bool>> connections; // with true once the thread is done
+    bool running = true;
+
+    // one thread per connection, which waits for its requests' jobs
+    auto serve = [&](int conn, bool *finished) {
+        std::string pending, line;
+        bool too_long;
+        while (read_line(conn, pending, line, &too_long)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            std::string answer;
+            if (line == "shutdown") {
+                answer = "ok";
+                std::lock_guard<std::mutex> guard(connections_lock);
+                running = false;
+                shutdown(fd, SHUT_RDWR); // wakes up accept
+            } else if (line == "stats") {
+                std::lock_guard<std::mutex> guard(state.lock);
+                answer = "ok " + state.log.summary(state.cache);
+            } else {
+                answer = serve_request(line, state);
+                fprintf(stderr, "%s -> %s\n", line.c_str(), answer.c_str());
+            }
+            answer += '\n';
+            if (!send_all(conn, answer.data(), answer.size())) break;
+        }
+        if (too_long) { // the rest of the connection cannot be split into requests, it is dropped
+            const std::string answer = "error request longer than " + std::to_string(MAX_LINE) + " bytes\n";
+            send_all(conn, answer.data(), answer.size());
+            fprintf(stderr, "request longer than %zu bytes, connection closed\n", MAX_LINE);
+        }
+        std::lock_guard<std::mutex> guard(connections_lock);
+        open.erase(conn);
+        close(conn);
+        *finished = true;
+    };
+    for (;;) {
+        int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        std::lock_guard<std::mutex> guard(connections_lock);
+        if (!running) {
+            if (conn >= 0) close(conn);
+            break;
+        }
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        for (auto it = connections.begin(); it != connections.end();) { // the threads of closed connections
+            if (!it->second) {
+                ++it;
+                continue;
+            }
+            it->first.join();
+            it = connections.erase(it);
+        }
+        open.insert(conn);
+        connections.emplace_back();
+        connections.back().second = false;
+        connections.back().first = std::thread(serve, conn, &connections.back().second);
+    }
+    {
+        // idle connections stop reading, the ones rendering answer first
+        std::lock_guard<std::mutex> guard(connections_lock);
+        for (int conn : open) shutdown(conn, SHUT_RD);
+    }
+    for (auto &c : connections) c.first.join();
+    close(fd);
+    unlink(path.c_str());
+    fprintf(stderr, "%s\n", state.log.summary(state.cache).c_str());
+    return 0;
+}
+
+// send request to the daemon at path and print the answer with the round trip time, the exit status is 0
+// for an ok answer
+inline int run_client(const std::string &path, const std::string &request) {
+    sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || !make_socket_address(path, addr) || connect(fd, (const sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "cannot connect to %s: %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::string line = request + "\n", pending, answer;
+    bool ok = send_all(fd, line.data(), line.size()) && read_line(fd, pending, answer);
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "no answer from %s\n", path.c_str());
+        return 1;
+    }
+    printf("%s\nround trip %.3f ms\n", answer.c_str(),
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    return answer.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
+
+#endif //__DAEMON_H__
@@ -0,0 +1,121 @@
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "gbuffer.h"
+#include "tracer.h"
+
+// Runtime instruction set dispatch. The tracing and per pixel kernels (tracer.inc, render.inc) are compiled
+// once for the baseline the binary is built for and once more for SSE4.2, AVX2 and AVX-512 in namespaces of
+// their own; the best variant the CPU supports is picked on first use, or one is forced with force_kernels.
+// Every variant renders the same image only if multiplies and adds are not fused into FMAs, which the AVX2 and
+// AVX-512 variants could otherwise do: build with -ffp-contract=off (the Makefile does), which applies to all
+// variants alike. It is a build flag rather than a pragma because GCC's optimize pragma resets the other
+// optimization settings of the functions that follow.
+
+const int TILE_SIZE = 16; // side of the square pixel blocks handed to the threads
+
+// offset from the pixel center of sample n of a pixel, the 2d golden ratio (R2) sequence: well spread for any
+// number of samples, and sample 0 is the center, so one sample per pixel is the plain pinhole render
+inline void sample_offset(int n, float &ox, float &oy) {
+    ox = n * .7548776662f, oy = n * .5698402910f;
+    ox -= std::floor(ox + .5f), oy -= std::floor(oy + .5f);
+}
+
+namespace isa_generic {
+#include "render.inc"
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_DISPATCH
+namespace isa_sse42 {
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#include "tracer.inc"
+#include "render.inc"
+#pragma GCC pop_options
+}
+namespace isa_avx2 {
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,bmi,bmi2,popcnt,f16c")
+#include "tracer.inc"
+#include "render.inc"
+#pragma GCC pop_options
+}
+namespace isa_avx512 {
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,bmi,bmi2,popcnt,f16c")
+#include "tracer.inc"
+#include "render.inc"
+#pragma GCC pop_options
+}
+#endif
+
+struct Kernels {
+    const char *name;
+    bool (*supported)();
+    void (*render_tile)(const SceneView &, const RayGenerator &, int, int, int, int, vec3 *, int, PixelCost *);
+    void (*render_tile_double)(const SceneView &, const RayGenerator &, int, int, int, int, vec3 *, int, PixelCost *);
+    void (*render_tile_deps)(const SceneView &, const RayGenerator &, int, int, int, int, vec3 *, int, PixelCost *);	// recording in thread_deps
+    void (*render_tile_double_deps)(const SceneView &, const RayGenerator &, int, int, int, int, vec3 *, int, PixelCost *);
+    void (*gbuffer_tile)(const SceneView &, const RayGenerator &, int, int, int, int, vec3 *, int, GSample *, bool);
+    void (*tonemap_pixels)(vec3 *, unsigned char *, size_t);
+    vec3 (*cast_ray)(const vec3 &, const vec3 &, const SceneView &, size_t);
+    bool (*scene_intersect)(const vec3 &, const vec3 &, const SceneView &, vec3 &, vec3 &, Material &);
+};
+
+// all variants built into the binary, worst first
+inline const Kernels *kernel_table(size_t &count) {
+#define RT_KERNELS(ns) ns::render_tile<float>, ns::render_tile<double>, ns::render_tile<float, true>, ns::render_tile<double, true>, \
+    ns::gbuffer_tile, ns::tonemap_pixels, ns::cast_ray<float>, \
+    ns::scene_intersect<float>
+    static const Kernels table[] = {
+        {"generic", [] { return true; }, RT_KERNELS(isa_generic)},
+#ifdef RT_DISPATCH
+        {"sse4.2", [] { return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"); }, RT_KERNELS(isa_sse42)},
+        {"avx2", [] { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"); },
+            RT_KERNELS(isa_avx2)},
+        {"avx512", [] { return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+            && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("bmi2"); },
+            RT_KERNELS(isa_avx512)},
+#endif
+    };
+#undef RT_KERNELS
+    count = sizeof(table) / sizeof(table[0]);
+    return table;
+}
+
+inline const Kernels *forced_kernels = nullptr;
+
+// the variant set with force_kernels, otherwise the best one the CPU supports
+inline const Kernels &active_kernels() {
+    static const Kernels *best = [] {
+        size_t n;
+        const Kernels *t = kernel_table(n);
+        while (n > 1 && !t[n - 1].supported()) n--;
+        return &t[n - 1];
+    }();
+    return forced_kernels ? *forced_kernels : *best;
+}
+
+// use the named variant from now on ("auto" for the best one), false if it is unknown or the CPU lacks it
+inline bool force_kernels(const std::string &name) {
+    size_t n;
+    const Kernels *t = kernel_table(n);
+    if (name == "auto") {
+        forced_kernels = nullptr;
+        return true;
+    }
+    for (size_t i = 0; i < n; i++)
+        if (name == t[i].name && t[i].supported()) return forced_kernels = &t[i], true;
+    return false;
+}
+
+#endif //__DISPATCH_H__
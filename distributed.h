@@ -0,0 +1,286 @@
+#ifndef __DISTRIBUTED_H__
+#define __DISTRIBUTED_H__
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "placement.h"
+#include "trace.h"
+#include "dispatch.h"
+
+// Rendering with several worker processes on one machine, for boxes with more sockets than one process
+// uses well. The master starts every worker as a new process with a Unix domain socket pair and hands out
+// image tiles over it one at a time: a worker gets its next tile when it returns the last one, so fast
+// workers take more of the image. Every worker loads the scene itself and renders a tile with its own
+// OpenMP threads. A worker that dies or exceeds the tile timeout is replaced and its tile handed out again.
+//
+// protocol, native byte order: the worker writes an empty TileMessage (w = h = 0) once its scene is loaded,
+// then the master writes a TileMessage at a time and the worker answers with the same TileMessage followed
+// by w * h * 3 floats, the linear rgb of the tile row by row. The worker exits when the master closes the
+// socket. The tile timeout counts from the tile being sent, the start of a worker has a timeout of its own, and
+// the rest of a message whose first bytes came has to follow within the reply timeout, so a worker that hangs
+// anywhere is replaced even without a tile timeout.
+
+struct TileMessage {
+    int32_t x0, y0, w, h;
+};
+
+// write or read exactly size bytes, false if the peer is gone
+inline bool send_all(int fd, const void *data, size_t size) {
+    const char *p = (const char *)data;
+    while (size) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n, size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void *data, size_t size) {
+    char *p = (char *)data;
+    while (size) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n, size -= size_t(n);
+    }
+    return true;
+}
+
+// recv_all that gives up at deadline, without blocking on the socket in between: a worker that stops in the
+// middle of a tile must not hold up the master
+inline bool recv_until(int fd, void *data, size_t size, std::chrono::steady_clock::time_point deadline) {
+    char *p = (char *)data;
+    while (size) {
+        ssize_t n = recv(fd, p, size, MSG_DONTWAIT);
+        if (n > 0) {
+            p += n, size -= size_t(n);
+            continue;
+        }
+        if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+        if (errno == EINTR) continue;
+        int wait = -1;
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left < 0) return false;
+            wait = int(std::min<long long>(left + 1, 1 << 30));
+        }
+        pollfd f = {fd, POLLIN, 0};
+        if (poll(&f, 1, wait) < 0 && errno != EINTR) return false;
+    }
+    return true;
+}
+
+// worker side: render the tiles the master asks for until it closes the socket. returns the exit status
+inline int run_worker(const SceneView &scene, int fd) {
+    const Kernels &kernels = active_kernels();
+    const auto render_tile = scene.settings.double_precision ? kernels.render_tile_double : kernels.render_tile;
+    const RayGenerator raygen(scene.camera, scene.settings.width, scene.settings.height);
+    std::vector<vec3> tile;
+    std::vector<float> rgb;
+    TileMessage m = {0, 0, 0, 0};
+    if (!send_all(fd, &m, sizeof(m))) return 1; // ready
+    while (recv_all(fd, &m, sizeof(m))) {
+        if (m.w <= 0 || m.h <= 0 || m.x0 < 0 || m.y0 < 0 || m.x0 + m.w > scene.settings.width || m.y0 + m.h > scene.settings.height)
+            return 1;
+        tile.assign(size_t(m.w) * m.h, vec3{0, 0, 0});
+        const int tiles_x = (m.w + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (m.h + TILE_SIZE - 1) / TILE_SIZE;
+        #pragma omp parallel for schedule(dynamic)
+        for (int t = 0; t < tiles_x * tiles_y; t++) {
+            const int x = t % tiles_x * TILE_SIZE, y = t / tiles_x * TILE_SIZE;
+            render_tile(scene, raygen, m.x0 + x, m.y0 + y, std::min(TILE_SIZE, m.w - x), std::min(TILE_SIZE, m.h - y),
+                &tile[x + size_t(y) * m.w], m.w, nullptr);
+        }
+        rgb.resize(tile.size() * 3);
+        for (size_t i = 0; i < tile.size(); i++) rgb[3 * i] = tile[i].x, rgb[3 * i + 1] = tile[i].y, rgb[3 * i + 2] = tile[i].z;
+        if (!send_all(fd, &m, sizeof(m)) || !send_all(fd, rgb.data(), rgb.size() * sizeof(float))) return 1;
+    }
+    return 0;
+}
+
+struct DistributedOptions {
+    int workers = 2;
+    int tile_size = 64;				// side of the tiles handed out, each is rendered in TILE_SIZE blocks by the worker's threads
+    double tile_timeout_ms = 0;		// a worker holding a tile longer than this is killed and replaced, 0 waits forever
+    double start_timeout_ms = 60000;	// a worker not ready this long after it was started is killed and replaced
+    double reply_timeout_ms = 10000;	// for the rest of a message once its first bytes arrived
+    int max_restarts = -1;			// replacements before giving up, < 0 means 2 per worker
+};
+
+struct DistributedStats {
+    int tiles = 0;						// tiles rendered
+    int restarts = 0;					// workers replaced after dying or timing out
+    std::vector<int> tiles_per_worker;	// per worker slot, over all the processes that held it
+};
+
+// master side: render the image into framebuffer (resized to width * height) with options.workers processes
+// running worker_command, which is given the socket as one more argument (--worker-fd n) and has to end up
+// in run_worker with the same scene and settings. false with a message in error if the image could not be
+// completed
+inline bool render_distributed(const SceneView &scene, Framebuffer &framebuffer, const std::vector<std::string> &worker_command,
+        const DistributedOptions &options, DistributedStats *stats, std::string &error) {
+    typedef std::chrono::steady_clock clock;
+    const int width = scene.settings.width, height = scene.settings.height;
+    const int size = std::max(1, options.tile_size);
+    const int workers = std::max(1, options.workers);
+    TraceScope render_scope("render");
+    framebuffer.assign(size_t(width) * height, vec3{0, 0, 0});
+
+    std::deque<TileMessage> pending;
+    for (int y = 0; y < height; y += size)
+        for (int x = 0; x < width; x += size) {
+            TileMessage t = {x, y, std::min(size, width - x), std::min(size, height - y)};
+            if (scene.settings.clip(t.x0, t.y0, t.w, t.h)) pending.push_back(t); // only the crop window's pixels
+        }
+    const size_t total = pending.size();
+
+    // the threads of all workers together should not oversubscribe the machine. set here rather than in the
+    // child, which may only make async signal safe calls between fork and exec; the OpenMP runtime of this
+    // process read the variable when it was loaded
+    setenv("OMP_NUM_THREADS", std::to_string(std::max(1, omp_get_num_procs() / workers)).c_str(), 0);
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        bool ready = false;	// sent its ready message
+        bool busy = false;
+        TileMessage tile;
+        clock::time_point since;	// started, or sent its tile
+    };
+    std::vector<Worker> pool(workers);
+    auto start = [&](Worker &w) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) return false;
+        std::vector<std::string> args = worker_command;
+        args.push_back("--worker-fd");
+        args.push_back(std::to_string(sv[1]));
+        std::vector<char *> argv;
+        for (std::string &a : args) argv.push_back(&a[0]);
+        argv.push_back(nullptr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sv[0]), close(sv[1]);
+            return false;
+        }
+        if (pid == 0) { // the worker keeps its end open across exec, the master's end and the other workers' are closed
+            fcntl(sv[1], F_SETFD, 0);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        close(sv[1]);
+        w.pid = pid, w.fd = sv[0], w.ready = w.busy = false, w.since = clock::now();
+        return true;
+    };
+    auto stop = [](Worker &w, bool kill_it) {
+        if (w.fd >= 0) close(w.fd);
+        if (kill_it) kill(w.pid, SIGKILL);
+        waitpid(w.pid, nullptr, 0);
+        w.pid = -1, w.fd = -1, w.ready = w.busy = false;
+    };
+
+    if (stats) *stats = DistributedStats(), stats->tiles_per_worker.assign(workers, 0);
+    const int max_restarts = options.max_restarts < 0 ? 2 * workers : options.max_restarts;
+    int restarts = 0;
+    size_t done = 0;
+    bool ok = true;
+    for (Worker &w : pool)
+        if (!start(w)) {
+            error = "cannot start a worker process";
+            ok = false;
+            break;
+        }
+
+    std::vector<float> rgb;
+    std::vector<pollfd> fds;
+    std::vector<int> slot;
+    while (ok && done < total) {
+        // an idle worker takes the next tile
+        for (Worker &w : pool) {
+            if (w.pid < 0 || !w.ready || w.busy || pending.empty()) continue;
+            w.tile = pending.front();
+            if (!send_all(w.fd, &w.tile, sizeof(w.tile))) continue; // it is gone, poll reports it below
+            pending.pop_front();
+            w.busy = true, w.since = clock::now();
+        }
+
+        fds.clear(), slot.clear();
+        for (int i = 0; i < workers; i++)
+            if (pool[i].pid >= 0) fds.push_back({pool[i].fd, POLLIN, 0}), slot.push_back(i);
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) { // wakes up for the timeouts
+            error = "poll failed";
+            ok = false;
+            break;
+        }
+        for (size_t k = 0; k < fds.size(); k++) {
+            Worker &w = pool[slot[k]];
+            bool failed = false;
+            // the ready message is due within the start timeout and a tile within the tile timeout, a message
+            // that started to arrive also within the reply timeout. a short read fails the worker
+            auto after = [](clock::time_point t, double ms) {
+                return ms > 0 ? t + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(ms)) : clock::time_point::max();
+            };
+            const clock::time_point deadline = !w.ready ? after(w.since, options.start_timeout_ms)
+                : w.busy ? after(w.since, options.tile_timeout_ms) : clock::time_point::max();
+            const clock::time_point reply_deadline = std::min(deadline, after(clock::now(), options.reply_timeout_ms));
+            if ((fds[k].revents & (POLLIN | POLLHUP | POLLERR)) && !w.ready) {
+                // the worker loaded its scene and takes tiles from now on
+                TileMessage m;
+                failed = !recv_until(w.fd, &m, sizeof(m), reply_deadline) || m.w != 0 || m.h != 0;
+                w.ready = !failed;
+            } else if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+                TileMessage m;
+                failed = !w.busy || !recv_until(w.fd, &m, sizeof(m), reply_deadline) || m.x0 != w.tile.x0 || m.y0 != w.tile.y0
+                    || m.w != w.tile.w || m.h != w.tile.h;
+                rgb.resize(size_t(w.tile.w) * w.tile.h * 3);
+                failed = failed || !recv_until(w.fd, rgb.data(), rgb.size() * sizeof(float), reply_deadline);
+                if (!failed) {
+                    for (int j = 0; j < m.h; j++)
+                        for (int i = 0; i < m.w; i++) {
+                            const float *c = &rgb[3 * (i + size_t(j) * m.w)];
+                            framebuffer[m.x0 + i + size_t(m.y0 + j) * width] = vec3{c[0], c[1], c[2]};
+                        }
+                    w.busy = false;
+                    done++;
+                    if (stats) stats->tiles_per_worker[slot[k]]++;
+                }
+            } else if (clock::now() > deadline) { // a start or a tile timed out
+                failed = true;
+            }
+            if (!failed) continue;
+            if (w.busy) pending.push_front(w.tile); // someone else renders it
+            stop(w, true);
+            if (++restarts > max_restarts) {
+                error = "workers failed " + std::to_string(restarts) + " times, giving up";
+                ok = false;
+                break;
+            }
+            fprintf(stderr, "worker %d failed, restarting it\n", slot[k]);
+            if (!start(w)) {
+                error = "cannot restart a worker process";
+                ok = false;
+                break;
+            }
+        }
+    }
+    for (Worker &w : pool)
+        if (w.pid >= 0) stop(w, !ok); // closing the socket ends a worker
+    if (stats) stats->tiles = int(done), stats->restarts = restarts;
+    return ok;
+}
+
+#endif //__DISTRIBUTED_H__
@@ -0,0 +1,58 @@
+#ifndef __GBUFFER_H__
+#define __GBUFFER_H__
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "snapshot.h"
+
+// G-buffer for relighting: the primary hit of every sample of every pixel, recorded by the first render of
+// a view. A later render of the same camera, resolution, sampling and geometry only shades the recorded hits,
+// tracing just the shadow and secondary rays, so lights and materials (colors, albedo, checker colors) can
+// change between the two. Anything else invalidates it and the next render records it again.
+
+struct GSample {
+    vec3 point, N;
+    int32_t material;	// index in SceneView::materials, -1 if the primary ray saw the background
+    int32_t checker;	// as reported by scene_hit
+};
+
+// hash of everything the primary hits depend on: the view, and the geometry through its generation, a counter
+// its owner changes whenever the geometry changes, so no relight hashes the spheres and planes
+inline uint64_t visibility_key(const SceneView &scene, uint64_t generation) {
+    std::vector<uint32_t> w;
+    auto put = [&w](float v) {
+        uint32_t u;
+        memcpy(&u, &v, 4);
+        w.push_back(u);
+    };
+    auto put3 = [&put](const vec3 &v) { put(v.x), put(v.y), put(v.z); };
+    const Camera &c = scene.camera;
+    put3(c.position), put3(c.forward), put3(c.up), put(c.hfov), put(c.aspect);
+    w.push_back(scene.settings.width), w.push_back(scene.settings.height), w.push_back(std::max(1, scene.settings.samples));
+    w.push_back(uint32_t(scene.materials.size())), w.push_back(uint32_t(scene.cx.size())), w.push_back(uint32_t(scene.planes.size()));
+    w.push_back(uint32_t(generation)), w.push_back(uint32_t(generation >> 32));
+    return content_hash(w.data(), w.size() * 4);
+}
+
+struct GBuffer {
+    uint64_t key = 0;
+    std::vector<GSample> samples;	// row major, the samples of a pixel one after the other
+    const uint64_t *generation = nullptr;	// of the geometry of the scene rendered, set by its owner. without it
+											// every render records
+
+    // true if the hits recorded hold for scene, otherwise make room to record them for it
+    bool prepare(const SceneView &scene) {
+        const uint64_t k = visibility_key(scene, generation ? *generation : 0);
+        const size_t n = size_t(scene.settings.width) * scene.settings.height * std::max(1, scene.settings.samples);
+        if (generation && k == key && samples.size() == n) return true;
+        key = k;
+        samples.assign(n, GSample{vec3{0, 0, 0}, vec3{0, 0, 0}, -1, -1});
+        return false;
+    }
+};
+
+#endif //__GBUFFER_H__
@@ -5,72 +5,193 @@
 #include <cmath>
 #include <cassert>
 #include <iostream>
+#if !defined(RT_SCALAR_VEC) && defined(__SSE2__)
+#include <immintrin.h>
+#elif !defined(RT_SCALAR_VEC) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-template <size_t DIM> struct vec {
-    float& operator[](const size_t i) {
+const float PI = 3.14159265359f;
+
+// DIM components of type T, float unless the tracer is instantiated in another precision (tracer.inc)
+template <size_t DIM, typename T = float> struct vec {
+    typedef T scalar;
+    T& operator[](const size_t i) {
         assert(i < DIM);
         return data[i];
     }
-    const float& operator[](const size_t i) const {
+    const T& operator[](const size_t i) const {
         assert(i < DIM); 
         return data[i];
     }
-    float data[DIM] = {};
+    T data[DIM] = {};
 };
 
-template<size_t DIM> vec<DIM> operator*(const vec<DIM> &lhs, const float rhs) {
-    vec<DIM> ret;
+// scalar arguments are not deduced, so a vec of floats can be scaled by a double constant and vice versa
+template<size_t DIM, typename T> vec<DIM, T> operator*(const vec<DIM, T> &lhs, const typename vec<DIM, T>::scalar rhs) {
+    vec<DIM, T> ret;
     for (size_t i = DIM; i--; ret[i] = lhs[i] * rhs);
     return ret;
 }
 
-template<size_t DIM> float operator*(const vec<DIM>& lhs, const vec<DIM>& rhs) {
-    float ret = 0;
+template<size_t DIM, typename T> T operator*(const vec<DIM, T>& lhs, const vec<DIM, T>& rhs) {
+    T ret = 0;
     for (size_t i = DIM; i--; ret += lhs[i] * rhs[i]);
     return ret;
 }
 
-template<size_t DIM> vec<DIM> operator+(vec<DIM> lhs, const vec<DIM>& rhs) {
+template<size_t DIM, typename T> vec<DIM, T> operator+(vec<DIM, T> lhs, const vec<DIM, T>& rhs) {
     for (size_t i = DIM; i--; lhs[i] += rhs[i]);
     return lhs;
 }
 
-template<size_t DIM> vec<DIM> operator-(vec<DIM> lhs, const vec<DIM>& rhs) {
+template<size_t DIM, typename T> vec<DIM, T> operator-(vec<DIM, T> lhs, const vec<DIM, T>& rhs) {
     for (size_t i = DIM; i--; lhs[i] -= rhs[i]);
     return lhs;
 }
 
-template<size_t DIM> vec<DIM> operator-(const vec<DIM> &lhs) {
-    return lhs * -1.f;
+template<size_t DIM, typename T> vec<DIM, T> operator-(const vec<DIM, T> &lhs) {
+    return lhs * T(-1);
 }
 
-template <> struct vec<3> {
-    float& operator[](const size_t i) {
+template <typename T> struct vec<3, T> {
+    typedef T scalar;
+    T& operator[](const size_t i) {
         assert(i < 3);
         return i==0 ? x : (1==i ? y : z);
     }
-    const float& operator[](const size_t i) const {
+    const T& operator[](const size_t i) const {
         assert(i<3);
         return i==0 ? x : (1==i ? y : z);
     }
-    float norm()
+    T norm() const
         { return std::sqrt(x*x+y*y+z*z); }
-    vec<3> & normalize(float l=1) {
+    vec<3, T> & normalize(T l=1) {
         *this = (*this) * (l / norm());
         return *this;
     }
-    float x = 0, y = 0, z = 0;
+    T x = 0, y = 0, z = 0;
 };
 
+#if !defined(RT_SCALAR_VEC) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define RT_SIMD_VEC
+#endif
+
+#ifdef RT_SIMD_VEC
+// vec3 and vec4 are one 128 bit register, so that add, sub, scale and cross are one or two instructions. The w
+// lane of a vec3 is kept at 0 and never read. Dot products add the lanes in the same order as the generic loops,
+// so images do not change; build with -DRT_SCALAR_VEC for the plain structs.
+namespace simd4 {
+#ifdef __SSE2__
+typedef __m128 f4;
+inline f4 set(float x, float y, float z, float w) { return _mm_set_ps(w, z, y, x); }
+inline f4 splat(float s) { return _mm_set1_ps(s); }
+inline f4 add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+inline f4 sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+inline f4 mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+inline f4 yzxw(f4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+#else
+typedef float32x4_t f4;
+inline f4 set(float x, float y, float z, float w) { const float v[4] = {x, y, z, w}; return vld1q_f32(v); }
+inline f4 splat(float s) { return vdupq_n_f32(s); }
+inline f4 add(f4 a, f4 b) { return vaddq_f32(a, b); }
+inline f4 sub(f4 a, f4 b) { return vsubq_f32(a, b); }
+inline f4 mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+inline f4 yzxw(f4 a) { // y z w x, then put x and w back in place
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3), vsetq_lane_f32(vgetq_lane_f32(a, 0), vextq_f32(a, a, 1), 2), 3);
+}
+#endif
+inline f4 zxyw(f4 a) { return yzxw(yzxw(a)); }
+} // namespace simd4
+
+template <> struct alignas(16) vec<3, float> {
+    typedef float scalar;
+    vec() : v(simd4::splat(0)) {}
+    vec(float x, float y, float z) : v(simd4::set(x, y, z, 0)) {}
+    explicit vec(simd4::f4 v) : v(v) {}
+
+    float& operator[](const size_t i) {
+        assert(i < 3);
+        return data[i];
+    }
+    const float& operator[](const size_t i) const {
+        assert(i<3);
+        return data[i];
+    }
+    float norm() const
+        { return std::sqrt(x*x+y*y+z*z); }
+    vec<3> & normalize(float l=1) {
+        v = simd4::mul(v, simd4::splat(l / norm()));
+        return *this;
+    }
+    union {
+        simd4::f4 v;
+        struct { float x, y, z, w; };
+        float data[4];
+    };
+};
+
+template <> struct alignas(16) vec<4, float> {
+    typedef float scalar;
+    vec() : v(simd4::splat(0)) {}
+    vec(float x, float y, float z, float w) : v(simd4::set(x, y, z, w)) {}
+    explicit vec(simd4::f4 v) : v(v) {}
+
+    float& operator[](const size_t i) {
+        assert(i < 4);
+        return data[i];
+    }
+    const float& operator[](const size_t i) const {
+        assert(i < 4);
+        return data[i];
+    }
+    union {
+        simd4::f4 v;
+        float data[4];
+    };
+};
+
+inline vec<3> operator+(const vec<3> &lhs, const vec<3> &rhs) { return vec<3>(simd4::add(lhs.v, rhs.v)); }
+inline vec<3> operator-(const vec<3> &lhs, const vec<3> &rhs) { return vec<3>(simd4::sub(lhs.v, rhs.v)); }
+inline vec<3> operator*(const vec<3> &lhs, const float rhs) { return vec<3>(simd4::mul(lhs.v, simd4::splat(rhs))); }
+inline vec<3> operator-(const vec<3> &lhs) { return lhs * -1.f; }
+inline float operator*(const vec<3> &lhs, const vec<3> &rhs) {
+    const vec<3> p(simd4::mul(lhs.v, rhs.v));
+    return p.z + p.y + p.x;
+}
+inline vec<4> operator+(const vec<4> &lhs, const vec<4> &rhs) { return vec<4>(simd4::add(lhs.v, rhs.v)); }
+inline vec<4> operator-(const vec<4> &lhs, const vec<4> &rhs) { return vec<4>(simd4::sub(lhs.v, rhs.v)); }
+inline vec<4> operator*(const vec<4> &lhs, const float rhs) { return vec<4>(simd4::mul(lhs.v, simd4::splat(rhs))); }
+inline vec<4> operator-(const vec<4> &lhs) { return lhs * -1.f; }
+inline float operator*(const vec<4> &lhs, const vec<4> &rhs) {
+    const vec<4> p(simd4::mul(lhs.v, rhs.v));
+    return p[3] + p[2] + p[1] + p[0];
+}
+#endif
+
 typedef vec<2> vec2;
 typedef vec<3> vec3;
 typedef vec<4> vec4;
+typedef vec<3, double> vec3d;
 
-vec3 cross(vec3 v1, vec3 v2) {
+template <typename T> vec<3, T> cross(vec<3, T> v1, vec<3, T> v2) {
     return { v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x };
 }
+#ifdef RT_SIMD_VEC
+inline vec3 cross(vec3 v1, vec3 v2) {
+    using namespace simd4;
+    return vec3(sub(mul(yzxw(v1.v), zxyw(v2.v)), mul(zxyw(v1.v), yzxw(v2.v))));
+}
+#endif
+
+// the same vector in another precision
+template <typename T, size_t DIM, typename U> vec<DIM, T> vec_cast(const vec<DIM, U> &v) {
+    vec<DIM, T> r;
+    for (size_t i = DIM; i--; r[i] = T(v[i]));
+    return r;
+}
 
-template <size_t DIM> std::ostream& operator<<(std::ostream& out, const vec<DIM>& v) {
+template <size_t DIM, typename T> std::ostream& operator<<(std::ostream& out, const vec<DIM, T>& v) {
     for (size_t i=0; i<DIM; i++)
         out << v[i] << " " ;
     return out ;
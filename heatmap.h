@@ -0,0 +1,71 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+// Per pixel cost, recorded by render() when asked for. time works in every build, rays and tests come from
+// the tracing counters and need RT_STATS.
+
+enum CostMetric { COST_TIME, COST_RAYS, COST_TESTS };
+
+struct PixelCost {
+    CostMetric metric = COST_TIME;
+    std::vector<float> values;	// row major, ns for COST_TIME, counts otherwise
+};
+
+// "time", "rays" or "tests", false if unknown
+inline bool parse_cost_metric(const std::string &s, CostMetric &m) {
+    if (s == "time") m = COST_TIME;
+    else if (s == "rays") m = COST_RAYS;
+    else if (s == "tests") m = COST_TESTS;
+    else return false;
+    return true;
+}
+
+// out.ppm -> out_heat.ppm
+inline std::string heatmap_path(const std::string &output) {
+    size_t dot = output.rfind('.'), slash = output.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return output + "_heat.ppm";
+    return output.substr(0, dot) + "_heat" + output.substr(dot);
+}
+
+// black, blue, cyan, green, yellow, red, white for t from 0 to 1
+inline vec3 heat_color(float t) {
+    static const vec3 ramp[] = {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}, {1, 1, 1}};
+    const int n = sizeof(ramp) / sizeof(ramp[0]) - 1;
+    t = std::max(0.f, std::min(1.f, t)) * n;
+    int i = std::min(n - 1, int(t));
+    return ramp[i] + (ramp[i + 1] - ramp[i]) * (t - i);
+}
+
+// write the cost as a false colour image scaled so that the 99.9th percentile is white, and print a summary
+// to stderr. false if the file cannot be written
+inline bool write_heatmap(const std::string &path, const PixelCost &cost, int width, int height) {
+    std::vector<float> sorted = cost.values;
+    if (sorted.empty()) return false;
+    std::sort(sorted.begin(), sorted.end());
+    auto pct = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))]; };
+    const float scale = pct(.999) > 0 ? pct(.999) : 1;
+    const char *unit = cost.metric == COST_TIME ? "ns" : cost.metric == COST_RAYS ? "rays" : "tests";
+    fprintf(stderr, "pixel cost (%s): min %.0f, median %.0f, p99 %.0f, max %.0f, max/median %.1f\n", unit,
+        sorted.front(), pct(.5), pct(.99), sorted.back(), pct(.5) > 0 ? sorted.back() / pct(.5) : 0.f);
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(size_t(width) * 3);
+    bool ok = true;
+    for (int j = 0; j < height && ok; j++) {
+        for (int i = 0; i < width; i++) {
+            vec3 c = heat_color(cost.values[i + size_t(j) * width] / scale);
+            row[3 * i] = (unsigned char)(255.f * c.x), row[3 * i + 1] = (unsigned char)(255.f * c.y), row[3 * i + 2] = (unsigned char)(255.f * c.z);
+        }
+        ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    return fclose(f) == 0 && ok;
+}
+
+#endif //__HEATMAP_H__
@@ -0,0 +1,110 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 8 bit rgb images as written by write_ppm, and the error metrics used to compare a render with a reference
+
+struct Image {
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;	// row major, 3 bytes per pixel
+};
+
+// read a binary ppm (P6, maxval 255), throws std::runtime_error if it cannot be read
+inline Image read_ppm(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("cannot open " + path);
+    Image img;
+    int maxval = 0;
+    auto number = [f]() { // skips whitespace and # comments
+        int c = fgetc(f);
+        while (c == '#' || (c != EOF && isspace(c))) {
+            if (c == '#') while (c != '\n' && c != EOF) c = fgetc(f);
+            c = fgetc(f);
+        }
+        int v = -1;
+        for (; c != EOF && isdigit(c); c = fgetc(f)) v = std::max(v, 0) * 10 + (c - '0');
+        return v; // the single whitespace after the number has been consumed
+    };
+    bool ok = fgetc(f) == 'P' && fgetc(f) == '6';
+    if (ok) img.width = number(), img.height = number(), maxval = number();
+    ok = ok && img.width > 0 && img.height > 0 && maxval == 255;
+    if (ok) {
+        img.rgb.resize(size_t(img.width) * img.height * 3);
+        ok = fread(img.rgb.data(), 1, img.rgb.size(), f) == img.rgb.size();
+    }
+    fclose(f);
+    if (!ok) throw std::runtime_error(path + ": not an 8 bit binary ppm");
+    return img;
+}
+
+// copy src into dst with its top left pixel at (x, y), throws std::runtime_error if it does not fit
+inline void paste_image(Image &dst, const Image &src, int x, int y) {
+    if (x < 0 || y < 0 || x + src.width > dst.width || y + src.height > dst.height)
+        throw std::runtime_error("a " + std::to_string(src.width) + "x" + std::to_string(src.height) + " image at "
+            + std::to_string(x) + "," + std::to_string(y) + " does not fit in " + std::to_string(dst.width) + "x" + std::to_string(dst.height));
+    for (int j = 0; j < src.height; j++)
+        std::copy_n(&src.rgb[3 * size_t(j) * src.width], 3 * size_t(src.width), &dst.rgb[3 * (x + size_t(y + j) * dst.width)]);
+}
+
+struct ImageError {
+    double psnr;			// dB over all channels, infinite for identical images
+    double ssim;			// mean structural similarity of the luma over 8x8 windows, 1 for identical images
+    int max_abs;			// largest difference of a channel, 0..255
+    size_t differing;		// number of differing channel values
+};
+
+// compare a with the reference b, throws std::runtime_error if their sizes differ
+inline ImageError compare_images(const Image &a, const Image &b) {
+    if (a.width != b.width || a.height != b.height)
+        throw std::runtime_error("image sizes differ: " + std::to_string(a.width) + "x" + std::to_string(a.height)
+            + " and " + std::to_string(b.width) + "x" + std::to_string(b.height));
+    ImageError e = {};
+    double sse = 0;
+    size_t differing = 0;
+    int max_abs = 0;
+    #pragma omp parallel for reduction(+:sse, differing) reduction(max:max_abs)
+    for (size_t i = 0; i < a.rgb.size(); i++) {
+        int d = std::abs(int(a.rgb[i]) - int(b.rgb[i]));
+        sse += double(d) * d;
+        differing += d != 0;
+        max_abs = std::max(max_abs, d);
+    }
+    e.differing = differing, e.max_abs = max_abs;
+    double mse = sse / a.rgb.size();
+    e.psnr = mse > 0 ? 10 * std::log10(255. * 255. / mse) : std::numeric_limits<double>::infinity();
+
+    // ssim of the luma, 8x8 windows every 4 pixels, constants of Wang et al. 2004
+    const int W = 8, STEP = 4;
+    const double C1 = (.01 * 255) * (.01 * 255), C2 = (.03 * 255) * (.03 * 255);
+    auto luma = [](const Image &img, size_t p) { return .299 * img.rgb[3 * p] + .587 * img.rgb[3 * p + 1] + .114 * img.rgb[3 * p + 2]; };
+    const int wx = std::max(1, (a.width - W) / STEP + 1), wy = std::max(1, (a.height - W) / STEP + 1);
+    double ssim_sum = 0;
+    #pragma omp parallel for reduction(+:ssim_sum) schedule(static)
+    for (int y = 0; y < wy; y++) {
+        for (int x = 0; x < wx; x++) {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            int n = 0;
+            for (int j = y * STEP; j < std::min(a.height, y * STEP + W); j++)
+                for (int i = x * STEP; i < std::min(a.width, x * STEP + W); i++, n++) {
+                    const size_t p = i + size_t(j) * a.width;
+                    const double va = luma(a, p), vb = luma(b, p);
+                    sa += va, sb += vb, saa += va * va, sbb += vb * vb, sab += va * vb;
+                }
+            const double ma = sa / n, mb = sb / n;
+            const double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+            ssim_sum += (2 * ma * mb + C1) * (2 * cov + C2) / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+        }
+    }
+    e.ssim = ssim_sum / (double(wx) * wy);
+    return e;
+}
+
+#endif //__IMAGE_H__
@@ -0,0 +1,220 @@
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "snapshot.h"
+
+// Dependency tracking for incremental re-rendering after the spheres of a scene are edited. While a tile
+// renders, every ray of its ray trees (primary, reflection, refraction, shadow) records in the tile's TileDeps
+// the primitive it hit, in a bloom filter, and the cells of a coarse grid over the scene its path crossed up
+// to that hit. After an edit only the tiles that hit a changed sphere where it was, or whose paths crossed a
+// cell of its new bounds, are rendered again; the other tiles keep the pixels of the last render.
+
+const int DEPS_GRID = 16;			// cells per axis
+const int DEPS_CELLS = DEPS_GRID * DEPS_GRID * DEPS_GRID;
+const int DEPS_BLOOM_BITS = 4096;	// per tile, two bits per primitive
+
+// uniform grid over the old scene's spheres, planes, lights and camera
+struct DepsGrid {
+    float lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0}, cell[3] = {1, 1, 1};
+
+    int cell_index(float v, int axis) const { return std::max(0, std::min(DEPS_GRID - 1, int((v - lo[axis]) / cell[axis]))); }
+};
+
+struct TileDeps {
+    uint64_t primitives[DEPS_BLOOM_BITS / 64];	// bloom filter of sphere indices (BVH order), planes after the spheres
+    uint64_t cells[DEPS_CELLS / 64];			// grid cells crossed
+    bool outside;								// a path left the grid, it could hit anything moved out of it
+
+    void clear() { memset(this, 0, sizeof(*this)); }
+
+    static uint32_t bloom_bit(uint32_t id, int k) {
+        uint64_t h = (id + 1ull) * (k ? 0xc4ceb9fe1a85ec53ull : 0xff51afd7ed558ccdull);
+        return uint32_t(h >> 40) % DEPS_BLOOM_BITS;
+    }
+    void add_primitive(uint32_t id) {
+        for (int k = 0; k < 2; k++) primitives[bloom_bit(id, k) / 64] |= 1ull << (bloom_bit(id, k) % 64);
+    }
+    // false only if id was never added
+    bool may_have(uint32_t id) const {
+        for (int k = 0; k < 2; k++)
+            if (!(primitives[bloom_bit(id, k) / 64] >> (bloom_bit(id, k) % 64) & 1)) return false;
+        return true;
+    }
+};
+
+// where the rays of the tile rendering on this thread record, set around the tiles rendered by the recording
+// instantiation of the kernels (render_tile_deps), which the other renders do not go through
+struct DepsTarget {
+    TileDeps *tile = nullptr;
+    const DepsGrid *grid = nullptr;
+};
+inline thread_local DepsTarget thread_deps;
+
+// record a ray from orig along dir (normalized) that hit primitive id at dist, or missed with id < 0.
+// walks the grid cells of the path with a 3D DDA
+inline void record_dependency(const vec3 &orig, const vec3 &dir, float dist, int id) {
+    TileDeps &d = *thread_deps.tile;
+    const DepsGrid &g = *thread_deps.grid;
+    if (id >= 0) d.add_primitive(uint32_t(id));
+    // clip the path to the grid
+    float t0 = 0, t1 = id >= 0 ? dist : std::numeric_limits<float>::max();
+    const float o[3] = {orig.x, orig.y, orig.z}, v[3] = {dir.x, dir.y, dir.z};
+    float enter = 0, leave = std::numeric_limits<float>::max();
+    for (int a = 0; a < 3; a++) {
+        if (v[a] == 0) {
+            if (o[a] < g.lo[a] || o[a] > g.hi[a]) enter = 1, leave = 0;
+            continue;
+        }
+        float ta = (g.lo[a] - o[a]) / v[a], tb = (g.hi[a] - o[a]) / v[a];
+        if (ta > tb) std::swap(ta, tb);
+        enter = std::max(enter, ta), leave = std::min(leave, tb);
+    }
+    if (enter > 0 || t1 > leave) d.outside = true;
+    t0 = std::max(t0, enter), t1 = std::min(t1, leave);
+    if (t0 > t1) return;
+
+    int c[3], step[3];
+    float next[3], delta[3];
+    for (int a = 0; a < 3; a++) {
+        c[a] = g.cell_index(o[a] + v[a] * t0, a);
+        step[a] = v[a] > 0 ? 1 : -1;
+        delta[a] = v[a] != 0 ? g.cell[a] / std::abs(v[a]) : std::numeric_limits<float>::max();
+        const float boundary = g.lo[a] + (c[a] + (v[a] > 0)) * g.cell[a];
+        next[a] = v[a] != 0 ? (boundary - o[a]) / v[a] : std::numeric_limits<float>::max();
+    }
+    for (;;) {
+        const int i = (c[2] * DEPS_GRID + c[1]) * DEPS_GRID + c[0];
+        d.cells[i / 64] |= 1ull << (i % 64);
+        const int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        if (next[a] > t1) break;
+        c[a] += step[a];
+        if (c[a] < 0 || c[a] >= DEPS_GRID) break;
+        next[a] += delta[a];
+    }
+}
+
+// the bounds of the spheres, the planes, the lights and the camera, a little larger
+inline DepsGrid make_deps_grid(const SceneView &scene) {
+    DepsGrid g;
+    float lo[3], hi[3];
+    for (int a = 0; a < 3; a++) lo[a] = hi[a] = scene.camera.position[a];
+    auto add = [&](float x, float y, float z) {
+        const float p[3] = {x, y, z};
+        for (int a = 0; a < 3; a++) lo[a] = std::min(lo[a], p[a]), hi[a] = std::max(hi[a], p[a]);
+    };
+    if (scene.nodes.size()) add(scene.nodes[0].lo[0], scene.nodes[0].lo[1], scene.nodes[0].lo[2]), add(scene.nodes[0].hi[0], scene.nodes[0].hi[1], scene.nodes[0].hi[2]);
+    for (const Plane &p : scene.planes) add(p.xmin, p.y, p.zmin), add(p.xmax, p.y, p.zmax);
+    for (const Light &l : scene.lights) add(l.position.x, l.position.y, l.position.z);
+    for (int a = 0; a < 3; a++) {
+        const float pad = std::max(1e-3f, (hi[a] - lo[a]) * 1e-3f);
+        g.lo[a] = lo[a] - pad, g.hi[a] = hi[a] + pad;
+        g.cell[a] = (g.hi[a] - g.lo[a]) / DEPS_GRID;
+    }
+    return g;
+}
+
+// hash of everything but the spheres, a render with any of it changed starts over
+inline uint64_t incremental_key(const SceneView &scene) {
+    std::vector<uint32_t> w;
+    auto put = [&w](float v) {
+        uint32_t u;
+        memcpy(&u, &v, 4);
+        w.push_back(u);
+    };
+    auto put3 = [&put](const vec3 &v) { put(v.x), put(v.y), put(v.z); };
+    const Camera &c = scene.camera;
+    const RenderSettings &s = scene.settings;
+    put3(c.position), put3(c.forward), put3(c.up), put(c.hfov), put(c.aspect);
+    w.push_back(s.width), w.push_back(s.height), w.push_back(s.max_depth), w.push_back(std::max(1, s.samples));
+    w.push_back(s.shadows), w.push_back(s.double_precision), put3(s.background);
+    for (const Material &m : scene.materials) put(m.refractive_index), put(m.albedo[0]), put(m.albedo[1]), put(m.albedo[2]),
+        put(m.albedo[3]), put3(m.diffuse_color), put(m.specular_exponent);
+    for (const Plane &p : scene.planes) put(p.y), put(p.xmin), put(p.xmax), put(p.zmin), put(p.zmax), w.push_back(p.material),
+        put3(p.color1), put3(p.color2);
+    for (const Light &l : scene.lights) put3(l.position), put(l.intensity);
+    w.push_back(uint32_t(scene.materials.size())), w.push_back(uint32_t(scene.cx.size())), w.push_back(uint32_t(scene.planes.size()));
+    return content_hash(w.data(), w.size() * 4);
+}
+
+// the spheres edited in place on a scene, in order, so an incremental render of it finds the ones changed
+// since its last one without comparing every sphere
+struct SphereEdits {
+    uint64_t base = 0;				// edits before the ones kept in ids, forgotten
+    std::vector<uint32_t> ids;		// BVH order
+
+    uint64_t end() const { return base + ids.size(); }
+    void add(uint32_t id) {
+        if (ids.size() >= 65536) base += ids.size(), ids.clear(); // a render that saw none of them starts over
+        ids.push_back(id);
+    }
+};
+
+// the last render of a view with the dependencies of its tiles
+struct IncrementalRender {
+    uint64_t key = 0;
+    DepsGrid grid;
+    std::vector<TileDeps> tiles;
+    std::vector<vec3> framebuffer;
+    const SphereEdits *edits = nullptr;	// of the scene rendered, set by its owner. without them every render is a full one
+    uint64_t seen = 0;					// edits.end() at the last render
+
+    // the tiles to render for scene: all of them if anything but the spheres changed, otherwise
+    // the ones that depend on a sphere edited since the last call. copies the last frame to framebuffer for the
+    // others and clears the dependencies of the returned ones
+    std::vector<int> prepare(const SceneView &scene, int tile_count, std::vector<vec3> &framebuffer) {
+        const uint64_t k = incremental_key(scene);
+        std::vector<int> dirty;
+        if (k != key || int(tiles.size()) != tile_count || this->framebuffer.size() != framebuffer.size() || !edits
+                || seen < edits->base) {
+            key = k;
+            grid = make_deps_grid(scene);
+            tiles.resize(tile_count);
+            for (int t = 0; t < tile_count; t++) dirty.push_back(t);
+        } else {
+            std::vector<uint32_t> changed(edits->ids.begin() + (seen - edits->base), edits->ids.end());
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            uint64_t cells[DEPS_CELLS / 64] = {};	// the new bounds of the changed spheres
+            bool beyond = false;					// some new bounds leave the grid
+            for (uint32_t i : changed) {
+                const float c[3] = {scene.cx[i], scene.cy[i], scene.cz[i]}, r = scene.radius[i];
+                int lo[3], hi[3];
+                for (int a = 0; a < 3; a++) {
+                    // half a cell more, a path grazing a cell boundary may have been walked on the other side
+                    beyond |= c[a] - r < grid.lo[a] || c[a] + r > grid.hi[a];
+                    lo[a] = grid.cell_index(c[a] - r - grid.cell[a] / 2, a), hi[a] = grid.cell_index(c[a] + r + grid.cell[a] / 2, a);
+                }
+                for (int z = lo[2]; z <= hi[2]; z++)
+                    for (int y = lo[1]; y <= hi[1]; y++)
+                        for (int x = lo[0]; x <= hi[0]; x++) {
+                            const int j = (z * DEPS_GRID + y) * DEPS_GRID + x;
+                            cells[j / 64] |= 1ull << (j % 64);
+                        }
+            }
+            for (int t = 0; t < tile_count && !changed.empty(); t++) {
+                const TileDeps &d = tiles[t];
+                bool hit = beyond && d.outside;
+                for (int w = 0; w < DEPS_CELLS / 64 && !hit; w++) hit = d.cells[w] & cells[w];
+                for (size_t i = 0; i < changed.size() && !hit; i++) hit = d.may_have(changed[i]);
+                if (hit) dirty.push_back(t);
+            }
+            framebuffer = this->framebuffer;
+        }
+        for (int t : dirty) tiles[t].clear();
+        seen = edits ? edits->end() : 0;
+        return dirty;
+    }
+
+    // keep the frame rendered from the tiles prepare returned
+    void finish(const std::vector<vec3> &frame) { framebuffer = frame; }
+};
+
+#endif //__INCREMENTAL_H__
@@ -1,181 +1,328 @@
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include "geometry.h"
+#include "camera.h"
+#include "scene.h"
+#include "accel.h"
+#include "snapshot.h"
+#include "scenes.h"
+#include "tracer.h"
+#include "render.h"
+#include "image.h"
+#include "distributed.h"
+#include "daemon.h"
 
-const float PI = 3.14159265359f;
-const int REFLECION_MAX_DEPTH = 4;
-
-struct Light {
-    vec3 position;
-    float intensity;
-};
-
-struct Material {
-	float refractive_index = 1; // > 1 means refractive
-    vec4 albedo = {1, 0, 0, 0}; //[0]: diffuse_color intensity, [1]: specular light intensity, [2]: smoothness, [3]: refractiveness
-    vec3 diffuse_color = {0, 0, 0}; // color of the sphere
-    float specular_exponent = 0;
-};
-
-struct Sphere {
-    vec3 center;
-    float radius;
-	Material material;
-};
-
-// determine if a ray from point orig with direction dir (normalized) intersect the sphere
-bool ray_sphere_intersect(const vec3 &orig, const vec3 &dir, const Sphere &s, float &t0) {
-	vec3 dist = s.center - orig;								// distance b/w center of sphere and orig
-    float projToOrigin = dist * dir;							// distance b/w the projection of the center on the ray and orig
-    float d2 = dist * dist - projToOrigin * projToOrigin;		// sqr of the distance b/w ray and center
-    if (d2 > s.radius * s.radius) return false;					// if the d2 is greater than radius, no intersection
-    float projToIntersections = sqrt(s.radius * s.radius - d2);	// distance b/w intersections and projection
-    t0 = projToOrigin - projToIntersections;					// distance from origin to first intersection
-    float t1 = projToOrigin + projToIntersections;				// distance from origin to second intersection
-    if (t0 < 0.001) t0 = t1;									// this happens when ray is inside the sphere
-    if (t0 < 0.001) return false;								// this happens when ray is in front of the sphere
-    return true;
-}
+// usage: raytracer [scene file | --generate distribution:count[:seed]] [--snapshot file] [--export file]
+//                  [--stats] [--stats-json file] [--heatmap time|rays|tests] [--trace file] [--perf]
+//                  [--resolution WxH] [--samples n] [--depth n] [--no-shadows] [--precision float|double]
+//                  [--crop WxH+X+Y [--composite full.ppm]] [--progressive] [--deadline ms]
+//                  [--compare golden.ppm [--min-psnr dB] [--min-ssim s] [--time-budget ms]] [--isa name|list]
+//                  [--workers n [--worker-tile n] [--worker-timeout ms]] [--numa [--huge-pages]]
+//        raytracer --daemon socket [--cache n] [--isa name]
+//        raytracer --connect socket "request"
+// renders the stock scene without a scene file or generator. with --snapshot the scene and its hierarchy are
+// mapped from the snapshot if it was made from the same scene, otherwise they are built and the snapshot is
+// (re)written. given a snapshot and no scene, the snapshot is rendered as is. --export writes the scene in
+// the text format instead of rendering it. --stats prints the tracing counters, --stats-json writes them, both
+// need a build with -DRT_STATS. --heatmap records the cost of every pixel and writes it as a false colour image
+// next to the output (out.ppm -> out_heat.ppm), counting rays or tests also needs -DRT_STATS. --trace writes
+// a timeline of the render phases and tiles per thread in the Chrome trace event format. --perf reads the
+// hardware counters (cycles, instructions, cache and branch misses) around every phase on every thread and
+// prints them with IPC and misses per ray. --resolution and --depth override the image size and the reflection
+// depth of the scene, --samples averages n rays per pixel and --no-shadows skips the shadow rays. --precision
+// double traces and shades in double, for scenes whose coordinates float cannot resolve. --crop traces only the
+// W x H window at (X, Y) of the image, with the same rays as in the full frame, and writes it as an image of its
+// own, or pasted into the full frame image given with --composite. --progressive traces every 16th pixel first and
+// refines at 8, 4, 2 and 1 pixel spacing, writing the output as a preview after every level. --deadline renders
+// within ms, lowering the depth and the samples per pixel as far as needed and filling what is left from a coarse
+// pass, and reports the quality reached.
+// --compare checks the image against a golden one, byte for byte unless a PSNR or SSIM threshold is given, and
+// the render time against --time-budget; the exit status is 2 if the image or the time is out of bounds.
+// --isa forces a variant of the tracing kernels (generic, sse4.2, avx2, avx512) instead of the best one the
+// CPU supports, --isa list prints the variants. --workers renders in n worker processes that load the scene
+// themselves from the scene and the options that change its pixels (distributed.h) and are handed worker-tile
+// sized tiles as they finish the last one; a worker that dies, does not start, stops in the middle of a reply or
+// holds a tile longer than --worker-timeout is restarted. --worker-fd is how a worker is started.
+// --numa pins the threads, places the framebuffer and a copy of the scene on every memory node (placement.h)
+// and reports where the pages went, --huge-pages backs them with transparent huge pages.
+// --daemon serves render requests on a Unix domain socket, keeping the last --cache scenes built (daemon.h);
+// --connect sends one request to it, see daemon.h for the request format
+int main(int argc, char **argv) {
+    std::string scene_path, snapshot_path, generator, export_path, stats_path, trace_path, golden_path;
+    bool print_stats_table = false, perf = false, numa = false, huge_pages = false;
+    PixelCost cost;
+    bool heatmap = false;
+    int width = 0, height = 0, samples = 1, depth = -1;
+    bool shadows = true, double_precision = false;
+    int crop[4] = {0, 0, 0, 0}; // w, h, x, y
+    std::string composite_path;
+    bool progressive = false;
+    double deadline_ms = 0;
+    double min_psnr = 0, min_ssim = 0, time_budget_ms = 0;
+    DistributedOptions distributed;
+    distributed.workers = 0;
+    int worker_fd = -1;
+    std::vector<std::string> worker_command = {"/proc/self/exe"}; // the scene and the options that change its pixels
+    // the others (output, tracing, placement, comparison) are the master's alone
+    const std::vector<std::string> render_options = {"--generate", "--resolution", "--samples", "--depth", "--no-shadows",
+        "--precision", "--isa"};
+    std::string daemon_path, connect_path, request;
+    size_t cache_size = 4;
+    const char *usage = " [scene file | --generate distribution:count[:seed]] [--snapshot file] [--export file]"
+        " [--stats] [--stats-json file] [--heatmap time|rays|tests] [--trace file] [--perf]"
+        " [--resolution WxH] [--samples n] [--depth n] [--no-shadows] [--precision float|double]"
+        " [--crop WxH+X+Y [--composite full.ppm]] [--progressive] [--deadline ms]"
+        " [--compare golden.ppm [--min-psnr dB] [--min-ssim s] [--time-budget ms]]"
+        " [--isa name|list] [--workers n [--worker-tile n] [--worker-timeout ms]] [--numa [--huge-pages]]"
+        " | --daemon socket [--cache n] | --connect socket \"request\"";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--workers" || arg == "--worker-tile" || arg == "--worker-timeout") && i + 1 < argc) {
+            if (arg == "--workers") distributed.workers = std::max(1, atoi(argv[i + 1]));
+            else if (arg == "--worker-tile") distributed.tile_size = std::max(1, atoi(argv[i + 1]));
+            else distributed.tile_timeout_ms = atof(argv[i + 1]);
+            i++;
+            continue;
+        }
+        if (arg == "--worker-fd" && i + 1 < argc) {
+            worker_fd = atoi(argv[++i]);
+            continue;
+        }
+        const int first = i;
+        if (arg == "--snapshot" && i + 1 < argc) snapshot_path = argv[++i];
+        else if (arg == "--generate" && i + 1 < argc) generator = argv[++i];
+        else if (arg == "--export" && i + 1 < argc) export_path = argv[++i];
+        else if (arg == "--stats") print_stats_table = true;
+        else if (arg == "--stats-json" && i + 1 < argc) stats_path = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc) trace_path = argv[++i];
+        else if (arg == "--perf") perf = true;
+        else if (arg == "--numa") numa = true;
+        else if (arg == "--daemon" && i + 1 < argc) daemon_path = argv[++i];
+        else if (arg == "--cache" && i + 1 < argc) cache_size = std::max(1, atoi(argv[++i]));
+        else if (arg == "--connect" && i + 2 < argc) connect_path = argv[++i], request = argv[++i];
+        else if (arg == "--huge-pages") huge_pages = true;
+        else if (arg == "--resolution" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0) i++;
+        else if (arg == "--samples" && i + 1 < argc) samples = std::max(1, atoi(argv[++i]));
+        else if (arg == "--depth" && i + 1 < argc) depth = std::max(0, atoi(argv[++i]));
+        else if (arg == "--no-shadows") shadows = false;
+        else if (arg == "--crop" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d+%d+%d", &crop[0], &crop[1], &crop[2], &crop[3]) == 4
+            && crop[0] > 0 && crop[1] > 0 && crop[2] >= 0 && crop[3] >= 0) i++;
+        else if (arg == "--composite" && i + 1 < argc) composite_path = argv[++i];
+        else if (arg == "--progressive") progressive = true;
+        else if (arg == "--deadline" && i + 1 < argc && atof(argv[i + 1]) > 0) deadline_ms = atof(argv[++i]);
+        else if (arg == "--precision" && i + 1 < argc && (std::string(argv[i + 1]) == "float" || std::string(argv[i + 1]) == "double"))
+            double_precision = std::string(argv[++i]) == "double";
+        else if (arg == "--isa" && i + 1 < argc && std::string(argv[i + 1]) == "list") {
+            size_t n;
+            const Kernels *t = kernel_table(n);
+            for (size_t k = 0; k < n; k++)
+                printf("%-8s %s%s\n", t[k].name, t[k].supported() ? "supported" : "not supported", &t[k] == &active_kernels() ? ", active" : "");
+            return 0;
+        } else if (arg == "--isa" && i + 1 < argc) {
+            if (!force_kernels(argv[++i])) {
+                std::cerr << "unknown or unsupported instruction set " << argv[i] << ", see --isa list" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--compare" && i + 1 < argc) golden_path = argv[++i];
+        else if (arg == "--min-psnr" && i + 1 < argc) min_psnr = atof(argv[++i]);
+        else if (arg == "--min-ssim" && i + 1 < argc) min_ssim = atof(argv[++i]);
+        else if (arg == "--time-budget" && i + 1 < argc) time_budget_ms = atof(argv[++i]);
+        else if (arg == "--heatmap" && i + 1 < argc && parse_cost_metric(argv[i + 1], cost.metric)) heatmap = true, i++;
+        else if (arg[0] != '-' && scene_path.empty()) scene_path = arg;
+        else {
+            std::cerr << "usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+        if (arg[0] != '-' || std::find(render_options.begin(), render_options.end(), arg) != render_options.end())
+            worker_command.insert(worker_command.end(), argv + first, argv + i + 1); // with its values
+    }
 
-// calculate the reflection using Phong Reflection Model
-vec3 reflect(const vec3 &I, const vec3 &N) {
-    return I - N * 2.f * (I * N);
-}
+    if (!daemon_path.empty()) return run_daemon(daemon_path, cache_size, omp_get_max_threads());
+    if (!connect_path.empty()) return run_client(connect_path, request);
 
-// calculate the refraction using Snell's Law
-vec3 refract(const vec3 &I, const vec3 &N, const float eta_t, const float eta_i=1.f) { // Snell's law
-    float cosi = - std::max(-1.f, std::min(1.f, I * N));
-    if (cosi<0) return refract(I, -N, eta_i, eta_t); // if the ray comes from the inside the object, swap the air and the media
-    float eta = eta_i / eta_t;
-    float k = 1 - eta * eta * (1 - cosi * cosi);
-    return k < 0 ? vec3{1,0,0} : I * eta + N * (eta * cosi - sqrt(k));
-}
+    if (!trace_path.empty()) trace_log.enable();
+    perf_profile.enabled = perf;
+    Scene scene;
+    Accel accel;
+    Snapshot snapshot;
+    SceneView view;
+    TraceScope setup_scope("scene setup");
+    PerfScope setup_perf("scene setup");
+    try {
+        std::string text;
+        uint64_t hash = 0;
+        GeneratorSpec spec;
+        if (!generator.empty()) {
+            spec = parse_generator_spec(generator);
+            std::string key = "generate " + to_string(spec) + " v" + std::to_string(GENERATOR_VERSION);
+            hash = content_hash(key.data(), key.size());
+        } else if (!scene_path.empty()) {
+            text = read_file(scene_path);
+            if (!snapshot_path.empty()) hash = content_hash(text.data(), text.size());
+        } else if (snapshot_path.empty() || !export_path.empty() || !open_snapshot(snapshot_path, snapshot)) {
+            scene = stock_scene();
+            hash = content_hash(scene);
+        }
 
-// return true if a sphere hit the ray, false otherwise. mutate variables to show what is the last hit
-bool scene_intersect(const vec3 &orig, const vec3 &dir, const std::vector<Sphere> &spheres, vec3 &hit, vec3 &N, Material &material) {
-    float spheres_dist = std::numeric_limits<float>::max();	// the distance to the closest sphere
-    for (size_t i = 0; i < spheres.size(); i++) {
-        float dist_i;
-		// check if intersects and closer than the closest sphere so far
-        if (ray_sphere_intersect(orig, dir, spheres[i], dist_i) && dist_i < spheres_dist) {
-            spheres_dist = dist_i; 						// make this one closer
-            hit = orig + dir * dist_i;					// the point ray hits the sphere
-            N = (hit - spheres[i].center).normalize();	// the normalized direction towards the hit from center
-            material = spheres[i].material;				// mutate material to show it later
+        if (!export_path.empty() || (!snapshot.base && (snapshot_path.empty() || !open_snapshot(snapshot_path, snapshot, hash)))) {
+            if (!generator.empty()) scene = generate_scene(spec);
+            else if (!scene_path.empty()) scene = parse_scene(text.data(), text.size(), scene_path);
+            std::string().swap(text);
+            if (!export_path.empty()) {
+                save_scene(export_path, scene);
+                return 0;
+            }
+            accel = build_accel(scene.spheres);
+            view = make_view(scene, accel);
+            if (!snapshot_path.empty()) save_snapshot(snapshot_path, view, hash);
+        } else {
+            view = snapshot.view;
         }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
-
-    float checkerboard_dist = std::numeric_limits<float>::max();
-    if (fabs(dir.y) > 0.001)  {
-        float d = -(orig.y + 4) / dir.y; // the checkerboard plane has equation y = -4
-        vec3 pt = orig + dir * d;
-        if (d > 0 && fabs(pt.x) < 10 && pt.z > 10 && pt.z < 30 && d < spheres_dist) {
-            checkerboard_dist = d;
-            hit = pt;
-            N = vec3{0, 1, 0};
-            material.diffuse_color = (int(.5 * hit.x + 1000) + int(.5 * hit.z)) & 1 ? vec3{1, 1, 1} : vec3{1, .7, .3};
-            material.diffuse_color = material.diffuse_color * .3;
+    setup_perf.end();
+    setup_scope.end();
+    if (width) view.settings.width = width, view.settings.height = height;
+    if (depth >= 0) view.settings.max_depth = depth;
+    view.settings.samples = samples, view.settings.shadows = shadows, view.settings.double_precision = double_precision;
+    if (crop[0]) {
+        if (crop[2] + crop[0] > view.settings.width || crop[3] + crop[1] > view.settings.height) {
+            std::cerr << "the crop window is not inside the " << view.settings.width << "x" << view.settings.height << " image" << std::endl;
+            return 1;
         }
+        view.settings.crop_width = crop[0], view.settings.crop_height = crop[1], view.settings.crop_x = crop[2], view.settings.crop_y = crop[3];
     }
-
-    return std::min(spheres_dist, checkerboard_dist) < 1000;
-}
-
-vec3 cast_ray(const vec3 &orig, const vec3 &dir, const std::vector<Sphere> &spheres, const std::vector<Light> &lights, size_t depth = 0) {
-    vec3 point, N; 		// point is where an object hits the ray, N is the normal from that sphere's center to the ray
-    Material material;	// material of the sphere hit
-
-    if (depth > REFLECION_MAX_DEPTH || !scene_intersect(orig, dir, spheres, point, N, material)) {
-        return vec3{0.4, 0.85, 1}; // background color
+    if (numa || huge_pages) numa_placement.enable(view, huge_pages);
+    if (worker_fd >= 0) return run_worker(view, worker_fd);
+    if ((progressive || deadline_ms > 0) && (distributed.workers || numa || huge_pages || crop[0])) {
+        std::cerr << "--progressive and --deadline do not combine with --workers, --numa, --huge-pages or --crop" << std::endl;
+        return 1;
     }
-
-	vec3 reflect_dir = reflect(dir, N);
-    vec3 reflect_orig = reflect_dir * N < 0 ? point - N * 0.001 : point + N * 0.001;
-    vec3 reflect_color = cast_ray(reflect_orig, reflect_dir, spheres, lights, depth + 1);
-
-	vec3 refract_dir = refract(dir, N, material.refractive_index).normalize();
-	vec3 refract_orig = refract_dir * N < 0 ? point - N * 0.001 : point + N * 0.001;
-	vec3 refract_color = cast_ray(refract_orig, refract_dir, spheres, lights, depth + 1);
-
-    float diffuse_light_intensity = 0, specular_light_intensity = 0;
-    for (size_t i = 0; i < lights.size(); i++) { // add more intensity for each light source
-        vec3 light_dir = (lights[i].position - point).normalize();	// direction of the light
-
-		// shadows
-        float light_distance = (lights[i].position - point).norm();
-
-		// check if the point lies in the shadow of the lights[i]
-        vec3 shadow_orig = light_dir * N < 0 ? point - N * 0.001 : point + N * 0.001;
-        
-		//basically uses the same idea with the rays and intersection with shadows
-		vec3 shadow_pt, shadow_N;
-        Material tmpmaterial;
-        if (scene_intersect(shadow_orig, light_dir, spheres, shadow_pt, shadow_N, tmpmaterial)
-			&& (shadow_pt - shadow_orig).norm() < light_distance) continue;
-		// shadows end
-
-		// if the angle between light_dir and N is less, the result of
-		//   light_dir * N will be greater, meaning a higher intensity of light. (At least 0)
-        diffuse_light_intensity += std::max(0.f, light_dir * N) * lights[i].intensity;
-        specular_light_intensity += pow(std::max(0.f, reflect(light_dir, N) * dir), material.specular_exponent) * lights[i].intensity;
+    if (progressive && deadline_ms > 0) {
+        std::cerr << "--progressive and --deadline do not combine" << std::endl;
+        return 1;
     }
-    return material.diffuse_color * diffuse_light_intensity * material.albedo[0] + vec3{1., 1., 1.} * specular_light_intensity
-		* material.albedo[1] + reflect_color * material.albedo[2] + refract_color * material.albedo[3];
-}
-
-void render(const std::vector<Sphere> &spheres, const std::vector<Light> &lights) {
-    const int width = 3840;
-    const int height = 2160;
-    const float hFOV = PI / 2.f; // horizontal field of view is 90 degrees (half pi)
-    std::vector<vec3> framebuffer(width * height);
-
-    #pragma omp parallel for //multi thread
-	for (size_t i = 0; i < width; i++) {
-        for (size_t j = 0; j < height; j++) {
-            float x = (i + 0.5) -  width / 2.;			// find x component of ray
-            float y = -(j + 0.5) + height / 2.;			// find y component of ray
-            float z = width / (2. * tan(hFOV / 2.f));	// find z component of ray
-            framebuffer[i + j * width] = cast_ray(vec3{0, 0, 0}, vec3{x, y, z}.normalize(), spheres, lights);
+    if (deadline_ms > 0 && heatmap) {
+        std::cerr << "--heatmap does not combine with --deadline" << std::endl;
+        return 1;
+    }
+    if (distributed.workers && (heatmap || print_stats_table || !stats_path.empty())) {
+        std::cerr << "--heatmap and the tracing counters are not collected from worker processes" << std::endl;
+        return 1;
+    }
+#ifndef RT_STATS
+    if (print_stats_table || !stats_path.empty()) std::cerr << "built without RT_STATS, no counters to report" << std::endl;
+    print_stats_table = false, stats_path.clear();
+    if (heatmap && cost.metric != COST_TIME) {
+        std::cerr << "built without RT_STATS, the heatmap can only show time" << std::endl;
+        return 1;
+    }
+#endif
+    Framebuffer framebuffer;
+    TraceStats stats;
+    auto t0 = std::chrono::steady_clock::now();
+    if (distributed.workers) {
+        DistributedStats dstats;
+        std::string error;
+        if (!render_distributed(view, framebuffer, worker_command, distributed, &dstats, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        fprintf(stderr, "%d tiles, per worker:", dstats.tiles);
+        for (int n : dstats.tiles_per_worker) fprintf(stderr, " %d", n);
+        fprintf(stderr, ", %d restarts\n", dstats.restarts);
+    } else {
+        if (progressive) {
+            // previews replace the output whole, through a rename, so a viewer never reads half of one
+            const std::string preview_path = view.settings.output + ".preview";
+            render_progressive(view, framebuffer, [&](int spacing, const Framebuffer &image) {
+                const double at = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                fprintf(stderr, "level %2d: %.1f ms\n", spacing, at);
+                if (spacing == 1) return; // the final image is written below
+                Framebuffer preview = image;
+                if (!write_ppm(preview_path, preview, view.settings.width, view.settings.height)
+                    || rename(preview_path.c_str(), view.settings.output.c_str()))
+                    std::cerr << "cannot write the preview " << view.settings.output << std::endl;
+            }, &stats, heatmap ? &cost : nullptr);
+        } else if (deadline_ms > 0) {
+            const BudgetReport b = render_budgeted(view, framebuffer, deadline_ms, &stats);
+            fprintf(stderr, "deadline %.1f ms: depth %d of %d, %d of %d samples, %.1f%% of the pixels refined, finest full grid %s,"
+                " probe %.1f ms, render %.1f ms\n", deadline_ms, b.depth, view.settings.max_depth, b.samples, view.settings.samples,
+                100 * b.refined, b.finest ? ("every " + std::to_string(b.finest) + " px").c_str() : "none", b.probe_ms, b.render_ms);
+        } else {
+            render(view, framebuffer, &stats, heatmap ? &cost : nullptr);
         }
     }
-
-    std::ofstream ofs; // save the framebuffer to file
-    ofs.open("./out.ppm", std::ofstream::binary);
-    ofs << "P6\n" << width << " " << height << "\n255\n"; // set he ppm file properties
-    for (vec3& c : framebuffer) {
-		// if any of the RGB values of c is too high, scale it down to make it one.
-		float max = std::max(c[0], std::max(c[1], c[2]));
-        if (max > 1) c = c * (1. / max);
-
-		// output each pixel color
-        ofs << (char)(int)(255.f * c[0]) // red
-            << (char)(int)(255.f * c[1]) // green
-            << (char)(int)(255.f * c[2]); // blue
+    const double render_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    if (print_stats_table) print_stats(stderr, stats);
+    if (!stats_path.empty()) {
+        FILE *f = fopen(stats_path.c_str(), "w");
+        if (f) write_stats_json(f, stats);
+        if (!f || fclose(f)) std::cerr << "cannot write " << stats_path << std::endl;
+    }
+    Image image;
+    if (crop[0]) {
+        Framebuffer window = crop_framebuffer(framebuffer, view.settings);
+        image.width = crop[0], image.height = crop[1];
+        tonemap_quantize(window, image.rgb);
+    } else {
+        image.width = view.settings.width, image.height = view.settings.height;
+        tonemap_quantize(framebuffer, image.rgb);
+    }
+    if (!composite_path.empty()) {
+        try {
+            Image full = read_ppm(composite_path);
+            if (full.width != view.settings.width || full.height != view.settings.height)
+                throw std::runtime_error(composite_path + " is not " + std::to_string(view.settings.width) + "x" + std::to_string(view.settings.height));
+            paste_image(full, image, crop[2], crop[3]);
+            image = std::move(full);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (!write_ppm(view.settings.output, image.rgb, image.width, image.height)) {
+        std::cerr << "cannot write " << view.settings.output << std::endl;
+        return 1;
+    }
+    if (heatmap && !write_heatmap(heatmap_path(view.settings.output), cost, view.settings.width, view.settings.height)) {
+        std::cerr << "cannot write " << heatmap_path(view.settings.output) << std::endl;
+        return 1;
+    }
+    if (numa || huge_pages) numa_placement.report(stderr, framebuffer);
+    if (perf) {
+#ifdef RT_STATS
+        perf_profile.report(stderr, stats.rays(), "traced");
+#else
+        perf_profile.report(stderr, uint64_t(view.settings.width) * view.settings.height, "primary");
+#endif
+    }
+    if (!trace_path.empty() && !trace_log.write(trace_path.c_str())) {
+        std::cerr << "cannot write " << trace_path << std::endl;
+        return 1;
+    }
+    if (!golden_path.empty()) {
+        ImageError e;
+        try {
+            e = compare_images(image, read_ppm(golden_path));
+        } catch (const std::exception &ex) {
+            std::cerr << ex.what() << std::endl;
+            return 2;
+        }
+        const bool exact = min_psnr <= 0 && min_ssim <= 0;
+        const bool image_ok = exact ? e.differing == 0 : e.psnr >= min_psnr && e.ssim >= min_ssim;
+        const bool time_ok = time_budget_ms <= 0 || render_ms <= time_budget_ms;
+        fprintf(stderr, "%s: %s, PSNR %.2f dB, SSIM %.5f, max abs error %d, %zu values differ; render %.1f ms",
+            golden_path.c_str(), image_ok ? "ok" : "MISMATCH", e.psnr, e.ssim, e.max_abs, e.differing, render_ms);
+        if (time_budget_ms > 0) fprintf(stderr, " of %.1f ms%s", time_budget_ms, time_ok ? "" : " OVER BUDGET");
+        fprintf(stderr, "\n");
+        if (!image_ok || !time_ok) return 2;
     }
-    ofs.close();
-}
-
-int main() {
-    const Material      ivory = {1.0, {0.6,  0.3, 0.1, 0.0}, {0.4, 0.4, 0.3},   50.};
-    const Material      glass = {1.5, {0.0,  0.5, 0.1, 0.8}, {0.6, 0.7, 0.8},  125.};
-    const Material red_rubber = {1.0, {0.9,  0.1, 0.0, 0.0}, {0.3, 0.1, 0.1},   10.};
-    const Material     mirror = {1.0, {0.0, 10.0, 0.8, 0.0}, {1.0, 1.0, 1.0}, 1425.};
-
-    std::vector<Sphere> spheres = {
-        Sphere{vec3{-3,    0,   16}, 2,      ivory},
-        Sphere{vec3{-1.0, -1.5, 12}, 2,      glass},
-        Sphere{vec3{ 1.5, -0.5, 18}, 3, red_rubber},
-        Sphere{vec3{ 7,    5,   18}, 4,     mirror}
-    };
-
-    std::vector<Light> lights = {
-        {{-20, 20, -20}, 1.5},
-        {{ 30, 50,  25}, 1.8},
-        {{ 30, 20, -30}, 1.7}
-    };
-
-    render(spheres, lights);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,155 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <omp.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters around render phases, per thread, from perf_event_open(2). Only the calling
+// thread is counted, user space only, so it works with perf_event_paranoid <= 2 and no external profiler.
+// Counters the kernel or the (virtual) machine does not offer are reported as unavailable.
+
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+struct PerfCounts {
+    uint64_t value[PERF_EVENTS] = {};
+    bool valid[PERF_EVENTS] = {};
+
+    PerfCounts &operator+=(const PerfCounts &o) {
+        for (int e = 0; e < PERF_EVENTS; e++) value[e] += o.value[e], valid[e] = valid[e] || o.valid[e];
+        return *this;
+    }
+};
+
+// the counters of one thread, opened on first use and kept open for the life of the thread
+struct PerfThreadCounters {
+    int fd[PERF_EVENTS];
+
+    PerfThreadCounters() {
+        for (int e = 0; e < PERF_EVENTS; e++) fd[e] = -1;
+#ifdef __linux__
+        const uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        const std::pair<uint32_t, uint64_t> config[PERF_EVENTS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, l1d_read_miss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},	// last level cache
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = config[e].first;
+            attr.config = config[e].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)); // this thread, any cpu
+        }
+#endif
+    }
+    ~PerfThreadCounters() {
+#ifdef __linux__
+        for (int e = 0; e < PERF_EVENTS; e++) if (fd[e] >= 0) close(fd[e]);
+#endif
+    }
+
+    // running totals, scaled up when the kernel had to multiplex the counters
+    PerfCounts read_all() const {
+        PerfCounts c;
+#ifdef __linux__
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            uint64_t buf[3]; // value, time enabled, time running
+            if (fd[e] < 0 || ::read(fd[e], buf, sizeof(buf)) != sizeof(buf)) continue;
+            c.value[e] = buf[2] && buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0];
+            c.valid[e] = true;
+        }
+#endif
+        return c;
+    }
+};
+
+struct PerfProfile {
+    bool enabled = false;
+    std::mutex lock;
+    std::map<std::pair<std::string, int>, PerfCounts> phases; // (phase, omp thread) -> counts
+
+    void add(const char *phase, int thread, const PerfCounts &c) {
+        std::lock_guard<std::mutex> guard(lock);
+        phases[{phase, thread}] += c;
+    }
+
+    // per phase, every thread and the sum. rays is what the per ray columns divide by, named by ray_kind
+    void report(FILE *f, uint64_t rays, const char *ray_kind) {
+        bool any = false;
+        for (auto &p : phases) for (int e = 0; e < PERF_EVENTS; e++) any = any || p.second.valid[e];
+        if (!any) {
+            fprintf(f, "no hardware counters available (perf_event_open failed, check perf_event_paranoid or the hypervisor)\n");
+            return;
+        }
+        const char *names[PERF_EVENTS] = {"cycles", "instructions", "L1D misses", "LLC misses", "branch misses"};
+        fprintf(f, "%-18s %6s %16s %16s %6s %14s %14s %14s\n", "phase", "thread", names[0], names[1], "IPC", names[2], names[3], names[4]);
+        std::map<std::string, PerfCounts> totals;
+        auto row = [&](const std::string &phase, const std::string &thread, const PerfCounts &c) {
+            fprintf(f, "%-18s %6s", phase.c_str(), thread.c_str());
+            for (int e = 0; e < PERF_EVENTS; e++) {
+                if (e == PERF_L1D_MISSES) {
+                    if (c.valid[PERF_CYCLES] && c.valid[PERF_INSTRUCTIONS] && c.value[PERF_CYCLES])
+                        fprintf(f, " %6.2f", double(c.value[PERF_INSTRUCTIONS]) / c.value[PERF_CYCLES]);
+                    else fprintf(f, " %6s", "-");
+                }
+                if (c.valid[e]) fprintf(f, " %*llu", e < PERF_L1D_MISSES ? 16 : 14, (unsigned long long)c.value[e]);
+                else fprintf(f, " %*s", e < PERF_L1D_MISSES ? 16 : 14, "n/a");
+            }
+            fprintf(f, "\n");
+        };
+        for (auto &p : phases) totals[p.first.first] += p.second;
+        for (auto &p : phases) row(p.first.first, std::to_string(p.first.second), p.second);
+        for (auto &t : totals) row(t.first, "all", t.second);
+
+        const PerfCounts &r = totals["render"];
+        if (rays && (r.valid[PERF_CYCLES] || r.valid[PERF_L1D_MISSES] || r.valid[PERF_LLC_MISSES])) {
+            fprintf(f, "render per %s ray:", ray_kind);
+            const char *sep = " ";
+            for (int e = 0; e < PERF_EVENTS; e++)
+                if (r.valid[e]) fprintf(f, "%s%s %.2f", sep, names[e], double(r.value[e]) / rays), sep = ", ";
+            fprintf(f, "\n");
+        }
+    }
+};
+
+inline PerfProfile perf_profile;
+inline thread_local PerfThreadCounters *perf_thread_counters = nullptr; // leaked with the thread, threads live as long as the process
+
+// counts the scope on the calling thread and adds it to the phase when it ends
+struct PerfScope {
+    PerfScope(const char *phase) : phase(perf_profile.enabled ? phase : nullptr) {
+        if (!this->phase) return;
+        if (!perf_thread_counters) perf_thread_counters = new PerfThreadCounters;
+        begin = perf_thread_counters->read_all();
+    }
+    ~PerfScope() { end(); }
+
+    void end() {
+        if (!phase) return;
+        PerfCounts c = perf_thread_counters->read_all();
+        for (int e = 0; e < PERF_EVENTS; e++) c.value[e] -= begin.value[e];
+        perf_profile.add(phase, omp_get_thread_num(), c);
+        phase = nullptr;
+    }
+
+    const char *phase;
+    PerfCounts begin;
+};
+
+#endif //__PERF_H__
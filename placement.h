@@ -0,0 +1,367 @@
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <omp.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "geometry.h"
+#include "accel.h"
+
+// allocator that leaves the elements of a resize or a sized constructor unconstructed instead of value
+// initializing them on the calling thread, so the pages of a buffer are first touched by the threads that
+// write its elements. elements made with a value (assign(n, v), push_back) are constructed as usual
+template <typename T> struct FirstTouchAllocator : std::allocator<T> {
+    template <typename U> struct rebind {
+        typedef FirstTouchAllocator<U> other;
+    };
+    FirstTouchAllocator() = default;
+    template <typename U> FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+    template <typename U> void construct(U *) noexcept {
+        static_assert(std::is_trivially_copyable<U>::value && std::is_trivially_destructible<U>::value, "plain data only");
+    }
+    template <typename U, typename... Args> void construct(U *p, Args &&...args) { ::new ((void *)p) U(std::forward<Args>(args)...); }
+};
+
+// a framebuffer whose resize leaves the pixels to be written, by render() or by the nodes' threads (place_framebuffer)
+typedef std::vector<vec3, FirstTouchAllocator<vec3>> Framebuffer;
+
+// NUMA aware placement for machines with several memory nodes, read from /sys without libnuma:
+//  - every render thread is pinned to a cpu, threads spread over the nodes in blocks
+//  - the image is split into one band of tile rows per node, rendered by that node's threads (which take
+//    tiles of other bands only when their own is done), and the framebuffer pages of a band are first
+//    touched by its node, so the kernel places them there
+//  - the read only scene arrays are copied once per node by a thread running on it, and every thread
+//    traces its node's copy
+//  - optionally the framebuffer and the copies are backed by transparent huge pages
+// With one node only the pinning and the banding apply. report() tells where the pages actually are and
+// how many framebuffer writes stayed on their node.
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;	// the ones this process may run on
+};
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+inline std::vector<int> parse_cpu_list(const std::string &s) {
+    std::vector<int> cpus;
+    for (size_t b = 0, e; b < s.size(); b = e + 1) {
+        e = std::min(s.find(',', b), s.size());
+        int lo, hi;
+        int n = sscanf(s.substr(b, e - b).c_str(), "%d-%d", &lo, &hi);
+        if (n == 1) hi = lo;
+        if (n >= 1) for (int c = lo; c <= hi; c++) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+// the memory nodes with cpus this process may use, or one node with all of them if the system has no NUMA
+// information
+inline std::vector<NumaNode> numa_nodes() {
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t set;
+    if (!sched_getaffinity(0, sizeof(set), &set))
+        for (int c = 0; c < CPU_SETSIZE; c++) if (CPU_ISSET(c, &set)) allowed.push_back(c);
+#endif
+    if (allowed.empty()) for (int c = 0; c < omp_get_num_procs(); c++) allowed.push_back(c);
+    std::vector<NumaNode> nodes;
+    for (int id = 0, missing = 0; missing < 64; id++) { // node numbers can have gaps
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        if (!in || !std::getline(in, list)) {
+            missing++;
+            continue;
+        }
+        missing = 0;
+        NumaNode n = {id, {}};
+        for (int c : parse_cpu_list(list))
+            if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) n.cpus.push_back(c);
+        if (!n.cpus.empty()) nodes.push_back(n);
+    }
+    if (nodes.empty()) nodes.push_back({0, allowed});
+    return nodes;
+}
+
+// pin the calling thread to one cpu, false if the system does not allow it
+inline bool pin_thread_to(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// node of every page of [p, p + bytes) as the kernel reports it, -1 for pages not yet touched. empty if
+// the query is not supported
+inline std::vector<int> page_nodes(const void *p, size_t bytes) {
+    std::vector<int> status;
+#ifdef __linux__
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = uintptr_t(p) / page * page, end = uintptr_t(p) + bytes;
+    std::vector<void *> pages;
+    for (uintptr_t a = begin; a < end; a += page) pages.push_back((void *)a);
+    status.assign(pages.size(), -1);
+    // move_pages without target nodes only reports where the pages are
+    if (!pages.empty() && syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0) status.clear();
+#else
+    (void)p, (void)bytes;
+#endif
+    return status;
+}
+
+inline void advise_huge_pages(void *p, size_t bytes) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    uintptr_t begin = (uintptr_t(p) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    uintptr_t end = (uintptr_t(p) + bytes) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (end > begin) madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+#else
+    (void)p, (void)bytes;
+#endif
+}
+
+// the scene arrays of a SceneView copied into one block of memory on a node
+struct SceneReplica {
+    void *base = nullptr;
+    size_t bytes = 0;
+    SceneView view;			// pointing into base
+    const float *source = nullptr;	// cx of the view it was copied from, to recognize it
+};
+
+struct NumaPlacement {
+    bool enabled = false;
+    bool huge_pages = false;
+    std::vector<NumaNode> nodes;
+    std::vector<SceneReplica> replicas;	// per node, empty with one node
+
+    // the tiles of the current render: a band of tile rows per node and the next tile of every band
+    int tiles_x = 0;
+    std::vector<int> band_begin;						// nodes + 1 tile numbers, band k is [begin[k], begin[k + 1])
+    std::vector<std::atomic<int>> next;					// per band
+    std::vector<std::atomic<uint64_t>> local, stolen;	// tiles rendered per node, of its own band or another's
+
+    ~NumaPlacement() { release_replicas(); }
+
+    // find the nodes and copy scene to every one of them
+    void enable(const SceneView &scene, bool huge) {
+        enabled = true, huge_pages = huge;
+        nodes = numa_nodes();
+        next = std::vector<std::atomic<int>>(nodes.size());
+        local = std::vector<std::atomic<uint64_t>>(nodes.size());
+        stolen = std::vector<std::atomic<uint64_t>>(nodes.size());
+        replicate(scene);
+    }
+
+    // node and cpu of omp thread t of a team of n: threads spread over the nodes in blocks, and over the
+    // cpus of a node in turn
+    int thread_node(int t, int n) const { return int(size_t(t) * nodes.size() / std::max(n, 1)); }
+
+    // pin the calling omp thread and return its node
+    int pin_thread() {
+        static thread_local int pinned = -1;
+        const int t = omp_get_thread_num(), n = omp_get_num_threads();
+        const int node = thread_node(t, n);
+        int first = t;
+        while (first > 0 && thread_node(first - 1, n) == node) first--;
+        const NumaNode &nd = nodes[node];
+        const int cpu = nd.cpus[(t - first) % nd.cpus.size()];
+        if (pinned != cpu && pin_thread_to(cpu)) pinned = cpu;
+        return node;
+    }
+
+    // the copy of scene on node, or scene itself if there is none (one node, or another scene than the one
+    // given to enable)
+    SceneView view(int node, const SceneView &scene) const {
+        if (replicas.empty() || replicas[node].source != scene.cx.data || replicas[node].view.cx.size() != scene.cx.size()) return scene;
+        SceneView v = replicas[node].view;
+        v.camera = scene.camera, v.settings = scene.settings;
+        return v;
+    }
+
+    // split tiles_x * tiles_y tiles into bands of tile rows, sized by the threads every node runs
+    void begin_render(int tx, int ty, int threads) {
+        tiles_x = tx;
+        band_begin.assign(nodes.size() + 1, 0);
+        for (size_t k = 0; k < nodes.size(); k++) {
+            int first = 0;
+            while (first < threads && thread_node(first, threads) < int(k)) first++;
+            band_begin[k] = int(int64_t(ty) * first / std::max(threads, 1)) * tx;
+        }
+        band_begin[nodes.size()] = tx * ty;
+        for (size_t k = 0; k < nodes.size(); k++) next[k] = band_begin[k], local[k] = 0, stolen[k] = 0;
+    }
+
+    // the next tile for a thread of node, from its own band first, -1 when all are taken
+    int next_tile(int node) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const size_t band = (node + i) % nodes.size();
+            if (next[band].load(std::memory_order_relaxed) >= band_begin[band + 1]) continue;
+            const int t = next[band]++;
+            if (t >= band_begin[band + 1]) continue;
+            (i ? stolen : local)[node]++;
+            return t;
+        }
+        return -1;
+    }
+
+    // size the framebuffer to n black pixels of a width wide image with its pages placed on the nodes of the
+    // bands (begin_render first): the elements are left unconstructed by the resize (FirstTouchAllocator) and
+    // zeroed by the threads of the node whose band holds them, the first touch of the pages of a new buffer.
+    // pages already in place are kept, only a buffer that has to grow is reallocated
+    void place_framebuffer(Framebuffer &framebuffer, size_t n, int width, int tile_size) {
+        if (framebuffer.capacity() < n) {
+            Framebuffer().swap(framebuffer);
+            framebuffer.reserve(n);
+            if (huge_pages) advise_huge_pages(framebuffer.data(), n * sizeof(vec3));
+        }
+        framebuffer.resize(n);
+        vec3 *base = framebuffer.data();
+        std::atomic<size_t> zeroed(0);
+        #pragma omp parallel
+        {
+            const int node = pin_thread(), t = omp_get_thread_num(), threads = omp_get_num_threads();
+            int first = t, count = 0;
+            while (first > 0 && thread_node(first - 1, threads) == node) first--;
+            while (first + count < threads && thread_node(first + count, threads) == node) count++;
+            // this thread's share of the node's band
+            const size_t row_px = size_t(width) * tile_size;
+            const size_t begin = std::min(n, size_t(band_begin[node] / tiles_x) * row_px);
+            const size_t end = std::min(n, size_t(band_begin[node + 1] / tiles_x) * row_px);
+            const size_t b = begin + (end - begin) * (t - first) / count, e = begin + (end - begin) * (t - first + 1) / count;
+            for (size_t i = b; i < e; i++) ::new ((void *)(base + i)) vec3{0, 0, 0};
+            zeroed += e - b;
+        }
+        // a team smaller than the one the bands were made for leaves a node's band to nobody
+        if (zeroed != n)
+            for (size_t i = 0; i < n; i++) ::new ((void *)(base + i)) vec3{0, 0, 0};
+    }
+
+    void report(FILE *f, const Framebuffer &framebuffer) const {
+        fprintf(f, "numa: %zu node%s", nodes.size(), nodes.size() == 1 ? "" : "s");
+        for (const NumaNode &n : nodes) fprintf(f, ", node %d: %zu cpus", n.id, n.cpus.size());
+        fprintf(f, "\n");
+        size_t replica_bytes = 0;
+        for (const SceneReplica &r : replicas) replica_bytes += r.bytes;
+        if (!replicas.empty())
+            fprintf(f, "scene: a %.1f MB copy on every node, all scene reads are node local (without the copies %.0f%% of the "
+                "threads would read it from another node)\n", replica_bytes / 1e6 / replicas.size(), 100. * (nodes.size() - 1) / nodes.size());
+        else fprintf(f, "scene: one node, not replicated\n");
+
+        uint64_t own = 0, other = 0;
+        for (size_t k = 0; k < nodes.size(); k++) own += local[k], other += stolen[k];
+        const double local_share = own + other ? double(own) / (own + other) : 1;
+        fprintf(f, "tiles: %llu rendered by a thread of the node holding them, %llu by another node\n",
+            (unsigned long long)own, (unsigned long long)other);
+        const size_t fb_bytes = framebuffer.size() * sizeof(vec3);
+        if (nodes.size() > 1)
+            fprintf(f, "framebuffer: %.0f%% of the %.1f MB written node locally, zeroed by one thread only %.0f%% would be,"
+                " %.1f MB less cross node traffic per sample\n", 100 * local_share, fb_bytes / 1e6, 100. / nodes.size(),
+                fb_bytes / 1e6 * (local_share - 1. / nodes.size()));
+
+        // where the kernel actually put the pages
+        std::vector<int> where = page_nodes(framebuffer.data(), fb_bytes);
+        if (where.empty()) {
+            fprintf(f, "page placement: not available\n");
+            return;
+        }
+        auto histogram = [&](const char *what, const std::vector<int> &pages) {
+            std::vector<size_t> per(nodes.size() + 1, 0);
+            for (int p : pages) {
+                size_t k = 0;
+                while (k < nodes.size() && nodes[k].id != p) k++;
+                per[k]++;
+            }
+            fprintf(f, "%s pages:", what);
+            for (size_t k = 0; k < nodes.size(); k++) fprintf(f, " node %d %zu", nodes[k].id, per[k]);
+            if (per[nodes.size()]) fprintf(f, ", elsewhere or not present %zu", per[nodes.size()]);
+            fprintf(f, "\n");
+        };
+        histogram("framebuffer", where);
+        for (size_t k = 0; k < replicas.size(); k++)
+            histogram(("scene copy for node " + std::to_string(nodes[k].id)).c_str(), page_nodes(replicas[k].base, replicas[k].bytes));
+    }
+
+private:
+    void release_replicas() {
+#ifdef __linux__
+        for (SceneReplica &r : replicas) if (r.base) munmap(r.base, r.bytes);
+#endif
+        replicas.clear();
+    }
+
+    // one copy of the scene arrays per node, each written by a thread running on that node
+    void replicate(const SceneView &scene) {
+        release_replicas();
+#ifdef __linux__
+        if (nodes.size() < 2) return;
+        size_t offset = 0;
+        auto reserve = [&offset](size_t bytes) { size_t at = offset; offset = (offset + bytes + 63) / 64 * 64; return at; };
+        const size_t o_materials = reserve(scene.materials.size() * sizeof(Material));
+        const size_t o_cx = reserve(scene.cx.size() * sizeof(float)), o_cy = reserve(scene.cy.size() * sizeof(float));
+        const size_t o_cz = reserve(scene.cz.size() * sizeof(float)), o_radius = reserve(scene.radius.size() * sizeof(float));
+        const size_t o_material = reserve(scene.material.size() * sizeof(int));
+        const size_t o_nodes = reserve(scene.nodes.size() * sizeof(BVHNode));
+        const size_t o_planes = reserve(scene.planes.size() * sizeof(Plane)), o_lights = reserve(scene.lights.size() * sizeof(Light));
+        const size_t bytes = std::max<size_t>(offset, 64);
+
+        replicas.resize(nodes.size());
+        std::vector<std::thread> copiers;
+        for (size_t k = 0; k < nodes.size(); k++) {
+            SceneReplica &r = replicas[k];
+            r.base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (r.base == MAP_FAILED) {
+                r.base = nullptr;
+                continue;
+            }
+            r.bytes = bytes, r.source = scene.cx.data;
+            if (huge_pages) advise_huge_pages(r.base, bytes);
+            char *b = (char *)r.base;
+            // copy one array into the block and point the view at it
+            auto put = [b](auto &dst, const auto &src, size_t at) {
+                typedef typename std::remove_const<typename std::remove_pointer<decltype(src.data)>::type>::type T;
+                if (src.size()) memcpy(b + at, src.data, src.size() * sizeof(T));
+                dst = {(const T *)(b + at), src.size()};
+            };
+            copiers.emplace_back([&, k, put] {
+                pin_thread_to(nodes[k].cpus[0]); // first touch from the node
+                SceneView &v = replicas[k].view;
+                put(v.materials, scene.materials, o_materials);
+                put(v.cx, scene.cx, o_cx), put(v.cy, scene.cy, o_cy), put(v.cz, scene.cz, o_cz), put(v.radius, scene.radius, o_radius);
+                put(v.material, scene.material, o_material);
+                put(v.nodes, scene.nodes, o_nodes);
+                put(v.planes, scene.planes, o_planes), put(v.lights, scene.lights, o_lights);
+            });
+        }
+        for (std::thread &t : copiers) t.join();
+        bool complete = true;
+        for (SceneReplica &r : replicas) complete = complete && r.base;
+        if (!complete) release_replicas();
+#else
+        (void)scene;
+#endif
+    }
+};
+
+inline NumaPlacement numa_placement;
+
+#endif //__PLACEMENT_H__
@@ -0,0 +1,285 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "trace.h"
+#include "perf.h"
+#include "placement.h"
+#include "tracer.h"
+#include "dispatch.h"
+
+// trace the whole image into framebuffer (resized to width * height, row major), averaging settings.samples
+// rays per pixel, in double if settings.double_precision is set. with a crop window set only its pixels are
+// traced, the others stay black. with RT_STATS defined the ray counters of all threads are added to stats. if cost is given,
+// the cost of every pixel (all its samples) is recorded in it. with numa_placement enabled the threads are
+// pinned and render the tiles of their node's band from their node's copy of the scene
+void render(const SceneView &scene, Framebuffer &framebuffer, TraceStats *stats = nullptr, PixelCost *cost = nullptr) {
+    const int width = scene.settings.width;
+    const int height = scene.settings.height;
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const Kernels &kernels = active_kernels();
+    const auto render_tile = scene.settings.double_precision ? kernels.render_tile_double : kernels.render_tile;
+    TraceScope render_scope("render");
+    TraceScope setup_scope("render setup");
+    PerfScope setup_perf("render setup");
+    const bool numa = numa_placement.enabled;
+    if (numa) { // zeroed band by band by the threads of the nodes rendering them
+        numa_placement.begin_render(tiles_x, tiles_y, omp_get_max_threads());
+        numa_placement.place_framebuffer(framebuffer, size_t(width) * height, width, TILE_SIZE);
+    } else framebuffer.assign(size_t(width) * height, vec3{0, 0, 0});
+    const RayGenerator raygen(scene.camera, width, height);
+    if (cost) cost->values.assign(framebuffer.size(), 0.f);
+    setup_perf.end();
+    setup_scope.end();
+    auto tile = [&](const SceneView &view, int t) {
+        TraceScope tile_scope("tile", t);
+        int x0 = t % tiles_x * TILE_SIZE, y0 = t / tiles_x * TILE_SIZE;
+        int w = std::min(TILE_SIZE, width - x0), h = std::min(TILE_SIZE, height - y0);
+        if (view.settings.clip(x0, y0, w, h)) render_tile(view, raygen, x0, y0, w, h, &framebuffer[x0 + size_t(y0) * width], width, cost);
+    };
+
+    #pragma omp parallel //multi thread
+    {
+        PerfScope perf("render");
+#ifdef RT_STATS
+        thread_stats = TraceStats();
+#endif
+        if (numa) {
+            const int node = numa_placement.pin_thread();
+            const SceneView view = numa_placement.view(node, scene);
+            for (int t; (t = numa_placement.next_tile(node)) >= 0;) tile(view, t);
+        } else {
+            #pragma omp for schedule(dynamic) // one tile at a time
+            for (int t = 0; t < tiles_x * tiles_y; t++) tile(scene, t);
+        }
+#ifdef RT_STATS
+        #pragma omp critical
+        if (stats) *stats += thread_stats;
+#endif
+    }
+    (void)stats;
+}
+
+const int PROGRESSIVE_SPACING = 16; // pixel spacing of the first level, halved at every level down to 1
+
+// trace the pixels of the spacing grid into framebuffer, only the ones the grid of twice the spacing does not
+// have unless first is set. stops taking pixels at stop; if done is given the traced pixels are marked in it.
+// returns the number of pixels traced
+inline size_t render_level(const SceneView &scene, const RayGenerator &raygen, Framebuffer &framebuffer, int spacing,
+        bool first, std::chrono::steady_clock::time_point stop, std::vector<uint8_t> *done, TraceStats *stats, PixelCost *cost) {
+    const int width = scene.settings.width;
+    const int height = scene.settings.height;
+    const Kernels &kernels = active_kernels();
+    const auto render_tile = scene.settings.double_precision ? kernels.render_tile_double : kernels.render_tile;
+    const bool timed = stop != std::chrono::steady_clock::time_point::max();
+    size_t traced = 0;
+    #pragma omp parallel reduction(+:traced)
+    {
+        PerfScope perf("render");
+#ifdef RT_STATS
+        thread_stats = TraceStats();
+#endif
+        #pragma omp for schedule(dynamic)
+        for (int y = 0; y < height; y += spacing) {
+            // rows on the coarser grid only have the pixels in between it left, the others all of theirs
+            const bool coarser_row = !first && y % (2 * spacing) == 0;
+            for (int x = coarser_row ? spacing : 0, n = 0; x < width; x += coarser_row ? 2 * spacing : spacing, n++) {
+                if (timed && n % 16 == 0 && std::chrono::steady_clock::now() >= stop) break;
+                render_tile(scene, raygen, x, y, 1, 1, &framebuffer[x + size_t(y) * width], width, cost);
+                if (done) (*done)[x + size_t(y) * width] = 1;
+                traced++;
+            }
+        }
+#ifdef RT_STATS
+        #pragma omp critical
+        if (stats) *stats += thread_stats;
+#endif
+    }
+    (void)stats;
+    return traced;
+}
+
+// progressive rendering into framebuffer: trace the pixels of every 16th column of every 16th row first, then
+// at every level the pixels of the 8, 4, 2 and 1 spacing grids the coarser levels did not trace. after every
+// level preview(spacing, image) is called with an image in which every pixel not traced yet has the color of
+// the traced one at the top left of its spacing x spacing block; the last call (spacing 1) is given framebuffer
+// itself. every pixel is traced once with the ray render() gives it, so the result is the image render() makes
+template <typename Preview> void render_progressive(const SceneView &scene, Framebuffer &framebuffer, Preview preview,
+        TraceStats *stats = nullptr, PixelCost *cost = nullptr) {
+    const int width = scene.settings.width;
+    const int height = scene.settings.height;
+    TraceScope render_scope("render");
+    framebuffer.assign(size_t(width) * height, vec3{0, 0, 0});
+    const RayGenerator raygen(scene.camera, width, height);
+    if (cost) cost->values.assign(framebuffer.size(), 0.f);
+    Framebuffer filled;
+    for (int spacing = PROGRESSIVE_SPACING; spacing >= 1; spacing /= 2) {
+        TraceScope level_scope("level", spacing);
+        render_level(scene, raygen, framebuffer, spacing, spacing == PROGRESSIVE_SPACING, std::chrono::steady_clock::time_point::max(),
+            nullptr, stats, cost);
+        level_scope.end();
+        if (spacing == 1) break;
+        filled.resize(framebuffer.size());
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) {
+            const vec3 *row = &framebuffer[size_t(y - y % spacing) * width];
+            for (int x = 0; x < width; x++) filled[x + size_t(y) * width] = row[x - x % spacing];
+        }
+        preview(spacing, filled);
+    }
+    preview(1, framebuffer);
+}
+
+// what render_budgeted reached
+struct BudgetReport {
+    int depth = 0, samples = 1;		// chosen for the image
+    double probe_ms = 0;			// coarse pass and cost probe
+    double render_ms = 0;			// all of it
+    double refined = 0;				// fraction of the pixels traced with depth and samples, the others are filled
+    int finest = 0;					// spacing of the finest grid completed with depth and samples, 0 if none
+};
+
+// render within budget_ms, lowering the reflection depth and the samples per pixel of settings as far as the
+// budget needs: a coarse pass at depth 0 traces every 16th pixel of every 16th row, a probe of the same pixels at
+// the scene's depth measures what a ray tree costs, and the best depth and samples that fit the time left are
+// traced progressively (16, 8, 4, 2, 1 pixel spacing) until the image is done or the budget runs out. pixels
+// not traced by then repeat the closest traced one of a coarser grid, the coarse pass if there is none. the
+// coarse pass is always completed, so a budget shorter than it is overrun
+inline BudgetReport render_budgeted(const SceneView &scene, Framebuffer &framebuffer, double budget_ms, TraceStats *stats = nullptr) {
+    typedef std::chrono::steady_clock clock;
+    auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    const auto t0 = clock::now();
+    const clock::time_point deadline = t0 + std::chrono::microseconds(int64_t(budget_ms * 1e3));
+    const int width = scene.settings.width;
+    const int height = scene.settings.height;
+    const int max_depth = scene.settings.max_depth, max_samples = std::max(1, scene.settings.samples);
+    TraceScope render_scope("render");
+    const RayGenerator raygen(scene.camera, width, height);
+    BudgetReport report;
+
+    // coarse pass at depth 0, the floor of the image
+    TraceScope probe_scope("probe");
+    SceneView view = scene;
+    view.settings.max_depth = 0, view.settings.samples = 1;
+    Framebuffer coarse(size_t(width) * height, vec3{0, 0, 0});
+    auto start = clock::now();
+    const size_t grid = render_level(view, raygen, coarse, PROGRESSIVE_SPACING, true, clock::time_point::max(), nullptr, stats, nullptr);
+    const double cost0 = ms(start, clock::now()) / grid; // ms per pixel at depth 0, one sample
+    // cost of a pixel at the full depth, from as much of the same grid as the budget allows
+    double cost_max = cost0;
+    if (max_depth > 0) {
+        view.settings.max_depth = max_depth;
+        framebuffer.assign(size_t(width) * height, vec3{0, 0, 0}); // scratch until the image is traced into it
+        start = clock::now();
+        const size_t n = render_level(view, raygen, framebuffer, PROGRESSIVE_SPACING, true, deadline, nullptr, stats, nullptr);
+        cost_max = n ? ms(start, clock::now()) / n : budget_ms;
+        cost_max = std::max(cost_max, cost0);
+    }
+    probe_scope.end();
+    report.probe_ms = ms(t0, clock::now());
+
+    // a ray tree of depth d has up to 2^(d+1) - 1 rays, the cost in between grows like that. plan on 90% of what is left
+    const double left = ms(clock::now(), deadline) * .9, pixels = double(width) * height;
+    auto cost = [&](int d) { return max_depth ? cost0 + (cost_max - cost0) * (std::pow(2., d) - 1) / (std::pow(2., max_depth) - 1) : cost0; };
+    report.depth = 0;
+    for (int d = max_depth; d > 0; d--)
+        if (cost(d) * pixels <= left) {
+            report.depth = d;
+            break;
+        }
+    report.samples = std::max(1, std::min(max_samples, int(left / (cost(report.depth) * pixels))));
+
+    // the image at the chosen quality, coarse to fine until the deadline
+    view.settings.max_depth = report.depth, view.settings.samples = report.samples;
+    framebuffer.assign(size_t(width) * height, vec3{0, 0, 0});
+    std::vector<uint8_t> done(framebuffer.size(), 0);
+    size_t traced = 0;
+    for (int spacing = PROGRESSIVE_SPACING; spacing >= 1 && clock::now() < deadline; spacing /= 2) {
+        TraceScope level_scope("level", spacing);
+        const size_t expected = size_t((width + spacing - 1) / spacing) * ((height + spacing - 1) / spacing);
+        const size_t n = render_level(view, raygen, framebuffer, spacing, spacing == PROGRESSIVE_SPACING, deadline, &done, stats, nullptr);
+        traced += n;
+        if (traced == expected) report.finest = spacing; // all of this grid and the coarser ones
+    }
+    report.refined = traced / pixels;
+
+    // fill what the deadline left out
+    TraceScope fill_scope("fill");
+    if (traced < framebuffer.size()) {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const size_t p = x + size_t(y) * width;
+                if (done[p]) continue;
+                int s = 2;
+                for (; s <= PROGRESSIVE_SPACING; s *= 2) {
+                    const size_t q = x - x % s + size_t(y - y % s) * width;
+                    if (done[q]) {
+                        framebuffer[p] = framebuffer[q];
+                        break;
+                    }
+                }
+                if (s > PROGRESSIVE_SPACING) framebuffer[p] = coarse[x - x % PROGRESSIVE_SPACING + size_t(y - y % PROGRESSIVE_SPACING) * width];
+            }
+        }
+    }
+    fill_scope.end();
+    report.render_ms = ms(t0, clock::now());
+    return report;
+}
+
+// the pixels of the crop window of settings, the whole framebuffer if there is none
+Framebuffer crop_framebuffer(const Framebuffer &framebuffer, const RenderSettings &settings) {
+    if (!settings.crop_width) return framebuffer;
+    Framebuffer window(size_t(settings.crop_width) * settings.crop_height);
+    for (int j = 0; j < settings.crop_height; j++)
+        std::copy_n(&framebuffer[settings.crop_x + size_t(settings.crop_y + j) * settings.width], settings.crop_width,
+            &window[size_t(j) * settings.crop_width]);
+    return window;
+}
+
+// tone map the framebuffer in place and quantize it to 8 bit rgb
+void tonemap_quantize(Framebuffer &framebuffer, std::vector<unsigned char> &rgb) {
+    TraceScope scope("tonemap+quantize");
+    rgb.resize(framebuffer.size() * 3);
+    const Kernels &kernels = active_kernels();
+    const size_t n = framebuffer.size(), block = 4096;
+    #pragma omp parallel
+    {
+        PerfScope perf("tonemap+quantize");
+        #pragma omp for schedule(static)
+        for (size_t b = 0; b < n; b += block)
+            kernels.tonemap_pixels(&framebuffer[b], &rgb[3 * b], std::min(block, n - b));
+    }
+}
+
+// save 8 bit rgb as a binary ppm, false if the file cannot be written
+bool write_ppm(const std::string &path, const std::vector<unsigned char> &rgb, int width, int height) {
+    TraceScope scope("write");
+    PerfScope perf("write");
+    std::ofstream ofs; // save the framebuffer to file
+    ofs.open(path, std::ofstream::binary);
+    ofs << "P6\n" << width << " " << height << "\n255\n"; // set he ppm file properties
+    ofs.write((const char *)rgb.data(), rgb.size());
+    ofs.close();
+    return bool(ofs);
+}
+
+// tone map the framebuffer in place and save it as a binary ppm, false if the file cannot be written
+bool write_ppm(const std::string &path, Framebuffer &framebuffer, int width, int height) {
+    std::vector<unsigned char> rgb;
+    tonemap_quantize(framebuffer, rgb);
+    return write_ppm(path, rgb, width, height);
+}
+
+#endif //__RENDER_H__
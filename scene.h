@@ -0,0 +1,376 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+
+const int REFLECION_MAX_DEPTH = 4;
+
+struct Light {
+    vec3 position;
+    float intensity;
+};
+
+struct Material {
+	float refractive_index = 1; // > 1 means refractive
+    vec4 albedo = {1, 0, 0, 0}; //[0]: diffuse_color intensity, [1]: specular light intensity, [2]: smoothness, [3]: refractiveness
+    vec3 diffuse_color = {0, 0, 0}; // color of the sphere
+    float specular_exponent = 0;
+};
+
+struct Sphere {
+    vec3 center;
+    float radius;
+	int material; // index in Scene::materials
+};
+
+// horizontal checkerboard y = height, limited to the rectangle [xmin, xmax] x [zmin, zmax]
+struct Plane {
+    float y = -4;
+    float xmin = -10, xmax = 10, zmin = 10, zmax = 30;
+    int material = 0;					// the diffuse color of the material is replaced by the checker colors
+    vec3 color1 = {.3, .3, .3}, color2 = {.3, .21, .09};
+};
+
+struct RenderSettings {
+    int width = 3840;
+    int height = 2160;
+    int max_depth = REFLECION_MAX_DEPTH;
+    vec3 background = {0.4, 0.85, 1};
+    std::string output = "./out.ppm";
+    int samples = 1;		// primary rays per pixel, averaged. not part of the scene format, set per render
+    bool shadows = true;	// false lights every point by every light without tracing shadow rays
+    bool double_precision = false;	// trace and shade in double instead of float, for huge coordinate ranges
+    // crop window: only the pixels of the crop_width x crop_height rectangle at (crop_x, crop_y) are traced, each
+    // with the ray it has in the full image. 0 width: the whole image. not part of the scene format, set per render
+    int crop_x = 0, crop_y = 0, crop_width = 0, crop_height = 0;
+
+    // clip the w x h block at (x0, y0) to the crop window, false if nothing of it is left
+    bool clip(int &x0, int &y0, int &w, int &h) const {
+        if (!crop_width) return w > 0 && h > 0;
+        const int x1 = std::min(x0 + w, crop_x + crop_width), y1 = std::min(y0 + h, crop_y + crop_height);
+        x0 = std::max(x0, crop_x), y0 = std::max(y0, crop_y);
+        w = x1 - x0, h = y1 - y0;
+        return w > 0 && h > 0;
+    }
+};
+
+struct Scene {
+    std::vector<Material> materials;
+    std::vector<std::string> material_names;	// parallel to materials
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    std::vector<Light> lights;
+    Camera camera;
+    RenderSettings settings;
+
+    int add_material(const std::string &name, const Material &m) {
+        materials.push_back(m);
+        material_names.push_back(name);
+        return int(materials.size()) - 1;
+    }
+};
+
+// Scene text format, one statement per line, '#' starts a comment, angles in degrees:
+//   material <name> <refractive_index> <albedo0..3> <diffuse r g b> <specular_exponent>
+//   sphere   <x y z> <radius> <material name>
+//   plane    <y> <xmin xmax zmin zmax> <material name> <color1 r g b> <color2 r g b>
+//   light    <x y z> <intensity>
+//   camera   <position x y z> <forward x y z> <up x y z> <hfov> [aspect]
+//   render   <width> <height> <max_depth> [output path]
+//   background <r g b>
+// Materials may be used before they are declared. Large inputs are cut into chunks at line boundaries
+// which are parsed in parallel, then concatenated in file order.
+
+namespace scene_parser {
+
+struct Chunk {
+    const char *begin, *end;
+    Scene scene;							// materials, spheres, ... of this chunk only
+    std::vector<std::string_view> names;	// material names referenced by this chunk, Sphere/Plane::material index this
+    bool has_camera = false, has_render = false, has_background = false;
+    const char *error = nullptr;			// position and message of the first error
+    std::string message;
+};
+
+struct Cursor {
+    const char *p, *end;
+
+    void skip_blanks() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    }
+    bool at_eol() {
+        skip_blanks();
+        return p == end || *p == '\n' || *p == '#';
+    }
+    std::string_view word() {
+        skip_blanks();
+        const char *b = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+        return std::string_view(b, p - b);
+    }
+    bool number(float &v) {
+        skip_blanks();
+        if (p < end && *p == '+') p++;	// from_chars does not accept a leading '+'
+        auto res = std::from_chars(p, end, v);
+        if (res.ec != std::errc()) return false;
+        p = res.ptr;
+        return true;
+    }
+    bool number(int &v) {
+        skip_blanks();
+        auto res = std::from_chars(p, end, v);
+        if (res.ec != std::errc()) return false;
+        p = res.ptr;
+        return true;
+    }
+    bool numbers(vec3 &v) { return number(v.x) && number(v.y) && number(v.z); }
+};
+
+// index of name in the chunk local name table
+inline int local_name(Chunk &c, std::string_view name) {
+    for (size_t i = c.names.size(); i--;) // scenes have few materials, a linear scan from the most recent is enough
+        if (c.names[i] == name) return int(i);
+    c.names.push_back(name);
+    return int(c.names.size()) - 1;
+}
+
+inline void parse_chunk(Chunk &c) {
+    Cursor cur{c.begin, c.end};
+    while (cur.p < cur.end) {
+        const char *line = cur.p;
+        bool ok = true;
+        std::string_view key = cur.word();
+        if (key.empty()) { // blank or comment line
+        } else if (key == "sphere") {
+            Sphere s;
+            ok = cur.numbers(s.center) && cur.number(s.radius);
+            std::string_view name = cur.word();
+            ok = ok && !name.empty();
+            s.material = local_name(c, name);
+            c.scene.spheres.push_back(s);
+        } else if (key == "material") {
+            std::string_view name = cur.word();
+            Material m;
+            ok = !name.empty() && cur.number(m.refractive_index) && cur.number(m.albedo[0]) && cur.number(m.albedo[1])
+                && cur.number(m.albedo[2]) && cur.number(m.albedo[3]) && cur.numbers(m.diffuse_color) && cur.number(m.specular_exponent);
+            c.scene.add_material(std::string(name), m);
+        } else if (key == "plane") {
+            Plane pl;
+            ok = cur.number(pl.y) && cur.number(pl.xmin) && cur.number(pl.xmax) && cur.number(pl.zmin) && cur.number(pl.zmax);
+            std::string_view name = cur.word();
+            ok = ok && !name.empty() && cur.numbers(pl.color1) && cur.numbers(pl.color2);
+            pl.material = local_name(c, name);
+            c.scene.planes.push_back(pl);
+        } else if (key == "light") {
+            Light l;
+            ok = cur.numbers(l.position) && cur.number(l.intensity);
+            c.scene.lights.push_back(l);
+        } else if (key == "camera") {
+            Camera &cam = c.scene.camera;
+            float fov;
+            ok = cur.numbers(cam.position) && cur.numbers(cam.forward) && cur.numbers(cam.up) && cur.number(fov);
+            cam.hfov = fov * PI / 180.f;
+            if (ok && !cur.at_eol()) ok = cur.number(cam.aspect);
+            c.has_camera = true;
+        } else if (key == "render") {
+            RenderSettings &rs = c.scene.settings;
+            ok = cur.number(rs.width) && cur.number(rs.height) && cur.number(rs.max_depth) && rs.width > 0 && rs.height > 0
+                && rs.max_depth >= 0; // a negative depth would never stop the recursion
+            if (ok && !cur.at_eol()) rs.output = std::string(cur.word());
+            c.has_render = true;
+        } else if (key == "background") {
+            ok = cur.numbers(c.scene.settings.background);
+            c.has_background = true;
+        } else {
+            c.error = line;
+            c.message = "unknown statement '" + std::string(key) + "'";
+            return;
+        }
+        if (!ok || !cur.at_eol()) {
+            c.error = line;
+            c.message = "malformed '" + std::string(key) + "' statement";
+            return;
+        }
+        while (cur.p < cur.end && *cur.p++ != '\n'); // skip the comment and the line feed
+    }
+}
+
+} // namespace scene_parser
+
+// parse a scene from memory, throws std::runtime_error with the source name and line number on malformed input
+inline Scene parse_scene(const char *data, size_t size, const std::string &source = "scene") {
+    using namespace scene_parser;
+    const size_t min_chunk = 1 << 20; // below this a chunk is not worth a thread
+    size_t nchunks = std::max<size_t>(1, std::min<size_t>(size / min_chunk, 256));
+    std::vector<Chunk> chunks(nchunks);
+    const char *end = data + size, *p = data;
+    for (size_t i = 0; i < nchunks; i++) { // cut right after a line feed
+        chunks[i].begin = p;
+        p = i + 1 == nchunks ? end : std::max(p, data + size / nchunks * (i + 1));
+        while (p < end && p[-1] != '\n') p++;
+        chunks[i].end = p;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < nchunks; i++) parse_chunk(chunks[i]);
+
+    Scene scene;
+    size_t nspheres = 0;
+    for (Chunk &c : chunks) {
+        if (c.error) {
+            size_t line = 1 + std::count(data, c.error, '\n');
+            throw std::runtime_error(source + ":" + std::to_string(line) + ": " + c.message);
+        }
+        for (size_t i = 0; i < c.scene.materials.size(); i++) // a later declaration of the same name wins
+            scene.add_material(c.scene.material_names[i], c.scene.materials[i]);
+        nspheres += c.scene.spheres.size();
+    }
+
+    // the camera, render and background statements are whole-scene, the last one in the file wins
+    for (Chunk &c : chunks) {
+        if (c.has_camera) scene.camera = c.scene.camera;
+        if (c.has_render) {
+            vec3 background = scene.settings.background;
+            scene.settings = c.scene.settings;
+            scene.settings.background = background;
+        }
+        if (c.has_background) scene.settings.background = c.scene.settings.background;
+    }
+
+    // map the chunk local material names to global indices
+    std::vector<std::vector<int>> remap(nchunks);
+    for (size_t i = 0; i < nchunks; i++) {
+        for (std::string_view name : chunks[i].names) {
+            int idx = -1;
+            for (size_t m = scene.materials.size(); m--;)
+                if (scene.material_names[m] == name) { idx = int(m); break; }
+            if (idx < 0) throw std::runtime_error(source + ": unknown material '" + std::string(name) + "'");
+            remap[i].push_back(idx);
+        }
+    }
+
+    std::vector<size_t> offsets(nchunks + 1, 0);
+    for (size_t i = 0; i < nchunks; i++) offsets[i + 1] = offsets[i] + chunks[i].scene.spheres.size();
+    scene.spheres.resize(nspheres);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < nchunks; i++) {
+        Sphere *out = scene.spheres.data() + offsets[i];
+        for (const Sphere &s : chunks[i].scene.spheres) {
+            *out = s;
+            out->material = remap[i][s.material];
+            out++;
+        }
+        std::vector<Sphere>().swap(chunks[i].scene.spheres);
+    }
+    for (size_t i = 0; i < nchunks; i++) {
+        for (Plane pl : chunks[i].scene.planes) {
+            pl.material = remap[i][pl.material];
+            scene.planes.push_back(pl);
+        }
+        scene.lights.insert(scene.lights.end(), chunks[i].scene.lights.begin(), chunks[i].scene.lights.end());
+    }
+    return scene;
+}
+
+inline std::string read_file(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("cannot open " + path);
+    std::string data;
+    fseek(f, 0, SEEK_END);
+    data.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    size_t n = fread(&data[0], 1, data.size(), f);
+    fclose(f);
+    if (n != data.size()) throw std::runtime_error("cannot read " + path);
+    return data;
+}
+
+inline Scene load_scene(const std::string &path) {
+    std::string data = read_file(path);
+    return parse_scene(data.data(), data.size(), path);
+}
+
+namespace scene_writer {
+
+inline void put(std::string &out, float v) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v); // shortest text that reads back as the same float
+    out += ' ';
+    out.append(buf, res.ptr);
+}
+
+inline void put(std::string &out, const vec3 &v) {
+    put(out, v.x), put(out, v.y), put(out, v.z);
+}
+
+} // namespace scene_writer
+
+// write the scene in the text format, numbers round trip exactly. throws std::runtime_error on failure
+inline void save_scene(const std::string &path, const Scene &scene) {
+    using namespace scene_writer;
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot create " + path);
+    std::string out;
+    bool ok = true;
+    for (size_t i = 0; i < scene.materials.size(); i++) {
+        const Material &m = scene.materials[i];
+        out += "material " + scene.material_names[i];
+        put(out, m.refractive_index);
+        for (int k = 0; k < 4; k++) put(out, m.albedo[k]);
+        put(out, m.diffuse_color), put(out, m.specular_exponent);
+        out += '\n';
+    }
+    for (const Plane &p : scene.planes) {
+        out += "plane";
+        put(out, p.y), put(out, p.xmin), put(out, p.xmax), put(out, p.zmin), put(out, p.zmax);
+        out += ' ' + scene.material_names[p.material];
+        put(out, p.color1), put(out, p.color2);
+        out += '\n';
+    }
+    for (const Light &l : scene.lights) {
+        out += "light";
+        put(out, l.position), put(out, l.intensity);
+        out += '\n';
+    }
+    const Camera &c = scene.camera;
+    out += "camera";
+    put(out, c.position), put(out, c.forward), put(out, c.up), put(out, c.hfov * 180.f / PI);
+    if (c.aspect > 0) put(out, c.aspect);
+    const RenderSettings &rs = scene.settings;
+    out += "\nrender " + std::to_string(rs.width) + " " + std::to_string(rs.height) + " " + std::to_string(rs.max_depth) + " " + rs.output;
+    out += "\nbackground";
+    put(out, rs.background);
+    out += '\n';
+    ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+
+    // spheres are formatted in parallel blocks and written in order
+    const size_t block = 1 << 16, nblocks = (scene.spheres.size() + block - 1) / block;
+    for (size_t b0 = 0; b0 < nblocks && ok; b0 += 64) {
+        const size_t b1 = std::min(nblocks, b0 + 64);
+        std::vector<std::string> text(b1 - b0);
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t b = b0; b < b1; b++) {
+            std::string &t = text[b - b0];
+            for (size_t i = b * block; i < std::min(scene.spheres.size(), (b + 1) * block); i++) {
+                const Sphere &s = scene.spheres[i];
+                t += "sphere";
+                put(t, s.center), put(t, s.radius);
+                t += ' ' + scene.material_names[s.material];
+                t += '\n';
+            }
+        }
+        for (size_t b = 0; b < text.size() && ok; b++) ok = fwrite(text[b].data(), 1, text[b].size(), f) == text[b].size();
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) throw std::runtime_error("cannot write " + path);
+}
+
+#endif //__SCENE_H__
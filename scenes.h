@@ -0,0 +1,174 @@
+#ifndef __SCENES_H__
+#define __SCENES_H__
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "scene.h"
+
+// built-in scenes: the stock scene and procedurally generated ones for scaling measurements
+
+inline void add_stock_materials(Scene &scene) {
+    scene.add_material("ivory",      {1.0, {0.6,  0.3, 0.1, 0.0}, {0.4, 0.4, 0.3},   50.});
+    scene.add_material("glass",      {1.5, {0.0,  0.5, 0.1, 0.8}, {0.6, 0.7, 0.8},  125.});
+    scene.add_material("red_rubber", {1.0, {0.9,  0.1, 0.0, 0.0}, {0.3, 0.1, 0.1},   10.});
+    scene.add_material("mirror",     {1.0, {0.0, 10.0, 0.8, 0.0}, {1.0, 1.0, 1.0}, 1425.});
+    scene.add_material("checker",    {});
+}
+enum StockMaterial { IVORY, GLASS, RED_RUBBER, MIRROR, CHECKER };
+
+inline void add_stock_lights(Scene &scene) {
+    scene.lights = {
+        {{-20, 20, -20}, 1.5},
+        {{ 30, 50,  25}, 1.8},
+        {{ 30, 20, -30}, 1.7}
+    };
+}
+
+// the scene this ray tracer was written for
+inline Scene stock_scene() {
+    Scene scene;
+    add_stock_materials(scene);
+
+    scene.spheres = {
+        Sphere{vec3{-3,    0,   16}, 2,      IVORY},
+        Sphere{vec3{-1.0, -1.5, 12}, 2,      GLASS},
+        Sphere{vec3{ 1.5, -0.5, 18}, 3, RED_RUBBER},
+        Sphere{vec3{ 7,    5,   18}, 4,     MIRROR}
+    };
+
+    Plane floor;
+    floor.material = CHECKER;
+    scene.planes = {floor};
+
+    add_stock_lights(scene);
+    return scene; // default camera at the origin looking down +z, 90 degrees horizontal fov
+}
+
+// Procedural scenes. Generation only uses integer arithmetic and + - * / on IEEE floats, which are exactly
+// rounded everywhere, and never lets the compiler fuse a multiply and an add, so a (distribution, count, seed)
+// triple gives the same spheres on every machine and compiler. Bump GENERATOR_VERSION whenever the output
+// for a given triple changes.
+
+const int GENERATOR_VERSION = 1;
+
+enum Distribution { UNIFORM, CLUSTERED, LAYERED };
+
+struct GeneratorSpec {
+    Distribution distribution = UNIFORM;
+    size_t count = 1000;
+    uint64_t seed = 1;
+};
+
+// cube root by newton iterations, libm cbrt is not exactly rounded and may differ between platforms
+inline double portable_cbrt(double v) {
+    double r = 1;
+    for (int i = 0; i < 200; i++) r = (2 * r + v / (r * r)) / 3;
+    return r;
+}
+
+// a + b * c, rounded twice even on targets where the compiler would contract it to a fused multiply-add
+inline float mul_add(float a, float b, float c) {
+    volatile float p = b * c;
+    return a + p;
+}
+
+// deterministic, platform independent random numbers
+struct SplitMix64 {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    float uniform() { return (next() >> 40) * (1.f / 16777216.f); }			// [0, 1)
+    float uniform(float lo, float hi) { return mul_add(lo, hi - lo, uniform()); }
+    float bell() { return uniform() + uniform() + uniform() + uniform() - 2.f; }	// approximately normal in (-2, 2), sigma .58
+};
+
+// parse "uniform|clustered|layered:count[:seed]", throws std::runtime_error if malformed
+inline GeneratorSpec parse_generator_spec(const std::string &spec) {
+    GeneratorSpec g;
+    size_t c1 = spec.find(':'), c2 = c1 == std::string::npos ? c1 : spec.find(':', c1 + 1);
+    std::string name = spec.substr(0, c1);
+    if (name == "uniform") g.distribution = UNIFORM;
+    else if (name == "clustered") g.distribution = CLUSTERED;
+    else if (name == "layered") g.distribution = LAYERED;
+    else throw std::runtime_error("unknown distribution '" + name + "', expected uniform, clustered or layered");
+    try {
+        if (c1 != std::string::npos) g.count = std::stoull(spec.substr(c1 + 1, c2 - c1 - 1));
+        if (c2 != std::string::npos) g.seed = std::stoull(spec.substr(c2 + 1));
+    } catch (const std::exception &) {
+        throw std::runtime_error("malformed generator spec '" + spec + "', expected distribution:count[:seed]");
+    }
+    if (g.count < 1 || g.count > 100000000) throw std::runtime_error("sphere count out of range in '" + spec + "'");
+    return g;
+}
+
+inline std::string to_string(const GeneratorSpec &g) {
+    const char *names[] = {"uniform", "clustered", "layered"};
+    return std::string(names[g.distribution]) + ":" + std::to_string(g.count) + ":" + std::to_string(g.seed);
+}
+
+// n spheres in the box x [-20, 20], y [-3.5, 16], z [20, 80] in front of the stock camera, occupying about
+// 5% of its volume whatever n is, above an enlarged stock checkerboard and lit by the stock lights
+inline Scene generate_scene(const GeneratorSpec &g) {
+    Scene scene;
+    add_stock_materials(scene);
+    add_stock_lights(scene);
+    Plane floor;
+    floor.material = CHECKER;
+    floor.xmin = -40, floor.xmax = 40, floor.zmin = 10, floor.zmax = 120;
+    scene.planes = {floor};
+
+    const float x0 = -20, x1 = 20, y0 = -3.5, y1 = 16, z0 = 20, z1 = 80;
+    const double volume = double(x1 - x0) * (y1 - y0) * (z1 - z0);
+    const float radius = float(portable_cbrt(.05 * volume / (g.count * 4.18879020479)));	// 4/3 pi r^3 n = 5% of the volume
+
+    SplitMix64 rng{g.seed * 0x2545f4914f6cdd1dull + g.distribution};
+    auto pick_material = [&rng]() { // 40% ivory, 30% red rubber, 15% mirror, 15% glass
+        float u = rng.uniform();
+        return u < .4f ? IVORY : u < .7f ? RED_RUBBER : u < .85f ? MIRROR : GLASS;
+    };
+
+    scene.spheres.resize(g.count);
+    if (g.distribution == UNIFORM) {
+        for (Sphere &s : scene.spheres) {
+            s.center = {rng.uniform(x0, x1), rng.uniform(y0, y1), rng.uniform(z0, z1)};
+            s.radius = rng.uniform(.5f, 1.5f) * radius;
+            s.material = pick_material();
+        }
+    } else if (g.distribution == CLUSTERED) {
+        // clusters of about 1000 spheres, gathered around random centers
+        const size_t nclusters = (g.count + 999) / 1000;
+        std::vector<vec3> centers(nclusters);
+        for (vec3 &c : centers) c = {rng.uniform(x0, x1), rng.uniform(y0, y1), rng.uniform(z0, z1)};
+        const float spread = float((x1 - x0) / 8 / portable_cbrt(double(nclusters)));
+        for (size_t i = 0; i < g.count; i++) {
+            Sphere &s = scene.spheres[i];
+            const vec3 &c = centers[i % nclusters];
+            s.center = {mul_add(c.x, rng.bell(), spread), mul_add(c.y, rng.bell(), spread), mul_add(c.z, rng.bell(), spread)};
+            s.radius = rng.uniform(.5f, 1.f) * radius;
+            s.material = pick_material();
+        }
+    } else { // LAYERED: jittered grids on horizontal layers, like shelves
+        size_t nlayers = 1;
+        while (nlayers * nlayers * nlayers * 64 < g.count) nlayers++;	// about (n / 64)^(1/3) layers
+        const size_t per_layer = (g.count + nlayers - 1) / nlayers;
+        size_t side = 1;
+        while (side * side < per_layer) side++;
+        const float cell_x = (x1 - x0) / side, cell_z = (z1 - z0) / side, layer_h = (y1 - y0) / nlayers;
+        const float lr = std::min(radius * 1.5f, std::min(std::min(cell_x, cell_z), layer_h) * .45f);
+        for (size_t i = 0; i < g.count; i++) {
+            Sphere &s = scene.spheres[i];
+            size_t layer = i / per_layer, k = i % per_layer;
+            s.center = {mul_add(x0, k % side + rng.uniform(.25f, .75f), cell_x), mul_add(y0, layer + .5f, layer_h), mul_add(z0, k / side + rng.uniform(.25f, .75f), cell_z)};
+            s.radius = lr;
+            s.material = pick_material();
+        }
+    }
+    return scene;
+}
+
+#endif //__SCENES_H__
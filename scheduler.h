@@ -0,0 +1,185 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "accel.h"
+#include "gbuffer.h"
+#include "incremental.h"
+#include "dispatch.h"
+
+// Tile scheduler for several render jobs at once on one pool of threads. Every job is split into
+// TILE_SIZE tiles and a thread that finishes a tile takes the next one of the most urgent job: the highest
+// priority, then the earliest deadline, then the oldest. A job is never interrupted inside a tile, but a more
+// urgent job that arrives takes every thread at its next tile boundary, so a preview is not stuck behind a
+// final frame. Jobs of the same priority and deadline run in arrival order, the older one takes every free
+// thread and the next one gets the threads as the older runs out of tiles.
+
+struct JobStats {
+    double wait_ms = 0;			// from submission to the start of the first tile
+    double latency_ms = 0;		// from submission to the end of the last tile
+    double busy_ms = 0;			// tile render time summed over the threads
+    int tiles = 0;
+    int preemptions = 0;		// tile boundaries at which a thread left the job for a more urgent one
+    bool has_deadline = false;
+    bool deadline_met = true;
+    bool relit = false;			// the primary hits came from the job's G-buffer
+    int tiles_kept = 0;			// incremental: tiles whose pixels came from the last render
+
+    // pixels per second of wall time from submission to the end
+    double mpixels_per_s(int width, int height) const { return latency_ms > 0 ? width * 1e-3 * height / latency_ms : 0; }
+};
+
+struct RenderJob {
+    typedef std::chrono::steady_clock clock;
+
+    RenderJob(const SceneView &scene, int priority, double deadline_ms, GBuffer *gbuffer, IncrementalRender *incremental)
+            : scene(scene), priority(priority), raygen(scene.camera, scene.settings.width, scene.settings.height), gbuffer(gbuffer),
+            incremental(incremental) {
+        tiles_x = (scene.settings.width + TILE_SIZE - 1) / TILE_SIZE;
+        tiles = tiles_x * ((scene.settings.height + TILE_SIZE - 1) / TILE_SIZE);
+        framebuffer.assign(size_t(scene.settings.width) * scene.settings.height, vec3{0, 0, 0});
+        submitted = clock::now();
+        deadline = deadline_ms > 0 ? submitted + std::chrono::microseconds(int64_t(deadline_ms * 1e3)) : clock::time_point::max();
+        stats.has_deadline = deadline_ms > 0;
+        if (gbuffer) stats.relit = gbuffer->prepare(scene);
+        if (incremental) {
+            order = incremental->prepare(scene, tiles, framebuffer);
+            stats.tiles_kept = tiles - int(order.size());
+            tiles = int(order.size());
+        }
+    }
+
+    // true if this job goes before o
+    bool more_urgent(const RenderJob &o) const {
+        if (priority != o.priority) return priority > o.priority;
+        if (deadline != o.deadline) return deadline < o.deadline;
+        return sequence < o.sequence;
+    }
+
+    SceneView scene;
+    int priority;				// higher first
+    clock::time_point deadline;	// earlier first among jobs of the same priority
+    RayGenerator raygen;
+    std::vector<vec3> framebuffer;
+    GBuffer *gbuffer;			// if not null the job records the primary hits in it, or shades the ones it holds
+    IncrementalRender *incremental;	// if not null the job renders only the tiles that depend on edited spheres
+    std::vector<int> order;		// with incremental, the tiles to render
+    JobStats stats;
+
+    // scheduler state, under TileScheduler::lock
+    uint64_t sequence = 0;
+    clock::time_point submitted, started;
+    int tiles_x, tiles;			// tiles to render
+    int next = 0;				// first tile not handed out
+    int done = 0;				// tiles finished
+    bool finished = false;
+};
+
+struct TileScheduler {
+    std::mutex lock;
+    std::condition_variable work;	// a job was submitted, or stop
+    std::condition_variable done;	// a job finished
+    std::vector<std::shared_ptr<RenderJob>> jobs; // with tiles left to hand out or in flight
+    std::vector<std::thread> threads;
+    uint64_t submitted = 0;
+    bool stop = false;
+
+    explicit TileScheduler(int nthreads) {
+        for (int i = 0; i < std::max(nthreads, 1); i++) threads.emplace_back([this] { run(); });
+    }
+    // finishes the jobs already submitted
+    ~TileScheduler() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        work.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+
+    // gbuffer or incremental, if given, belongs to the job until it is finished. with gbuffer it is rendered in float
+    std::shared_ptr<RenderJob> submit(const SceneView &scene, int priority = 0, double deadline_ms = 0, GBuffer *gbuffer = nullptr,
+            IncrementalRender *incremental = nullptr) {
+        auto job = std::make_shared<RenderJob>(scene, priority, deadline_ms, gbuffer, incremental);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job->sequence = submitted++;
+            if (job->tiles) jobs.push_back(job);
+            else job->finished = true;
+        }
+        work.notify_all();
+        return job;
+    }
+
+    // block until the job's framebuffer is complete
+    void wait(const RenderJob &job) {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return job.finished; });
+    }
+
+private:
+    // the most urgent job with tiles to hand out, null if there is none
+    std::shared_ptr<RenderJob> pick() const {
+        std::shared_ptr<RenderJob> best;
+        for (const auto &j : jobs)
+            if (j->next < j->tiles && (!best || j->more_urgent(*best))) best = j;
+        return best;
+    }
+
+    void run() {
+        typedef RenderJob::clock clock;
+        auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+        const Kernels &kernels = active_kernels();
+        std::shared_ptr<RenderJob> last;
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            std::shared_ptr<RenderJob> job;
+            work.wait(guard, [&] { return (job = pick()) || stop; });
+            if (!job) return;
+            if (last && last != job && last->next < last->tiles) last->stats.preemptions++;
+            const int n = job->next++, t = job->incremental ? job->order[n] : n;
+            if (n == 0) job->started = clock::now();
+            guard.unlock();
+
+            const auto t0 = clock::now();
+            const SceneView &scene = job->scene;
+            const int width = scene.settings.width, height = scene.settings.height;
+            const int x0 = t % job->tiles_x * TILE_SIZE, y0 = t / job->tiles_x * TILE_SIZE;
+            const int w = std::min(TILE_SIZE, width - x0), h = std::min(TILE_SIZE, height - y0);
+            vec3 *out = &job->framebuffer[x0 + size_t(y0) * width];
+            if (job->gbuffer) kernels.gbuffer_tile(scene, job->raygen, x0, y0, w, h, out, width, job->gbuffer->samples.data(), !job->stats.relit);
+            else if (job->incremental) {
+                thread_deps = {&job->incremental->tiles[t], &job->incremental->grid};
+                (scene.settings.double_precision ? kernels.render_tile_double_deps : kernels.render_tile_deps)(scene, job->raygen, x0, y0, w, h,
+                    out, width, nullptr);
+                thread_deps = DepsTarget();
+            } else (scene.settings.double_precision ? kernels.render_tile_double : kernels.render_tile)(scene, job->raygen, x0, y0, w, h,
+                out, width, nullptr);
+            const auto t1 = clock::now();
+
+            guard.lock();
+            job->stats.busy_ms += ms(t0, t1);
+            if (++job->done == job->tiles) {
+                JobStats &s = job->stats;
+                s.tiles = job->tiles;
+                s.wait_ms = ms(job->submitted, job->started), s.latency_ms = ms(job->submitted, t1);
+                s.deadline_met = t1 <= job->deadline;
+                job->finished = true;
+                jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+                done.notify_all();
+            }
+            last = job;
+        }
+    }
+};
+
+#endif //__SCHEDULER_H__
@@ -0,0 +1,199 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "accel.h"
+
+// Binary snapshot of a scene with its built hierarchy. The file is a header followed by the arrays of a
+// SceneView, each at a 64 byte aligned offset from the start of the file, so it can be mapped read only
+// and traced from directly. The header records the content hash of the source the snapshot was made
+// from, a stale snapshot is detected by comparing it with the hash of the current source.
+
+const uint32_t SNAPSHOT_VERSION = 2; // 2: vec3 and vec4 are 16 byte aligned
+
+// 64 bit hash of a byte range, 8 bytes per step. not cryptographic, only used to detect changes
+inline uint64_t content_hash(const void *data, size_t size, uint64_t h = 0x9e3779b97f4a7c15ull) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, p, size);
+    h = (h ^ w ^ (uint64_t(size) << 56)) * 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+// hash of a scene built in memory, for scenes that do not come from a file. hashed field by field, the
+// structs holding a vec3 or vec4 have padding bytes with unspecified values
+inline uint64_t content_hash(const Scene &s) {
+    std::vector<uint32_t> w;
+    auto put = [&w](float v) {
+        uint32_t u;
+        memcpy(&u, &v, 4);
+        w.push_back(u);
+    };
+    auto put3 = [&put](const vec3 &v) { put(v.x), put(v.y), put(v.z); };
+    for (const Material &m : s.materials) {
+        put(m.refractive_index), put(m.albedo[0]), put(m.albedo[1]), put(m.albedo[2]), put(m.albedo[3]);
+        put3(m.diffuse_color), put(m.specular_exponent);
+    }
+    for (const Sphere &sp : s.spheres) put3(sp.center), put(sp.radius), w.push_back(sp.material);
+    for (const Plane &p : s.planes) {
+        put(p.y), put(p.xmin), put(p.xmax), put(p.zmin), put(p.zmax), w.push_back(p.material);
+        put3(p.color1), put3(p.color2);
+    }
+    for (const Light &l : s.lights) put3(l.position), put(l.intensity);
+    put3(s.camera.position), put3(s.camera.forward), put3(s.camera.up), put(s.camera.hfov), put(s.camera.aspect);
+    w.push_back(s.settings.width), w.push_back(s.settings.height), w.push_back(s.settings.max_depth);
+    put3(s.settings.background);
+    w.push_back(uint32_t(s.materials.size())), w.push_back(uint32_t(s.spheres.size())), w.push_back(uint32_t(s.planes.size()));
+    uint64_t h = content_hash(w.data(), w.size() * 4);
+    return content_hash(s.settings.output.data(), s.settings.output.size(), h);
+}
+
+namespace snapshot_format {
+
+enum Section { MATERIALS, CX, CY, CZ, RADIUS, MATERIAL, NODES, PLANES, LIGHTS, SECTIONS };
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;				// sizes of the stored structs, a snapshot from another build with a different layout is rejected
+    uint64_t hash;					// content hash of the source
+    uint64_t file_size;
+    uint64_t offset[SECTIONS];		// from the start of the file
+    uint64_t count[SECTIONS];
+    Camera camera;
+    int32_t width, height, max_depth;
+    vec3 background;
+    char output[256];
+};
+
+const char MAGIC[8] = {'R', 'T', 'S', 'N', 'A', 'P', '\r', '\n'};
+
+inline uint32_t layout() {
+    return uint32_t(sizeof(Material) | sizeof(Plane) << 8 | sizeof(Light) << 16 | sizeof(BVHNode) << 24) ^ uint32_t(sizeof(Header));
+}
+
+static_assert(std::is_trivially_copyable<Material>::value && std::is_trivially_copyable<Plane>::value
+    && std::is_trivially_copyable<Light>::value && std::is_trivially_copyable<Camera>::value, "snapshot structs are written as raw bytes");
+
+} // namespace snapshot_format
+
+// write the scene and its hierarchy, throws std::runtime_error on failure. the file is written next to
+// path and renamed over it, so a reader never maps a half written snapshot. the arrays are written as they are
+// in memory, padding of the structs included, so compare snapshots by their hash and not byte for byte
+inline void save_snapshot(const std::string &path, const SceneView &v, uint64_t hash) {
+    using namespace snapshot_format;
+    const void *data[SECTIONS] = {v.materials.data, v.cx.data, v.cy.data, v.cz.data, v.radius.data, v.material.data, v.nodes.data, v.planes.data, v.lights.data};
+    const size_t count[SECTIONS] = {v.materials.size(), v.cx.size(), v.cy.size(), v.cz.size(), v.radius.size(), v.material.size(), v.nodes.size(), v.planes.size(), v.lights.size()};
+    const size_t elem[SECTIONS] = {sizeof(Material), 4, 4, 4, 4, 4, sizeof(BVHNode), sizeof(Plane), sizeof(Light)};
+
+    Header h;
+    memset((void *)&h, 0, sizeof(h)); // padding included, headers of the same scene are byte identical
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = SNAPSHOT_VERSION;
+    h.layout = layout();
+    h.hash = hash;
+    h.camera.position = v.camera.position, h.camera.forward = v.camera.forward, h.camera.up = v.camera.up;
+    h.camera.hfov = v.camera.hfov, h.camera.aspect = v.camera.aspect;
+    h.width = v.settings.width, h.height = v.settings.height, h.max_depth = v.settings.max_depth;
+    h.background = v.settings.background;
+    if (v.settings.output.size() >= sizeof(h.output)) throw std::runtime_error("output path too long for a snapshot");
+    memcpy(h.output, v.settings.output.c_str(), v.settings.output.size());
+    uint64_t offset = sizeof(Header);
+    for (int s = 0; s < SECTIONS; s++) {
+        offset = (offset + 63) & ~uint64_t(63);
+        h.offset[s] = offset, h.count[s] = count[s];
+        offset += count[s] * elem[s];
+    }
+    h.file_size = offset;
+
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot create " + tmp);
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    static const char zeros[64] = {};
+    uint64_t pos = sizeof(Header);
+    for (int s = 0; s < SECTIONS && ok; s++) {
+        ok = fwrite(zeros, 1, h.offset[s] - pos, f) == h.offset[s] - pos;
+        ok = ok && fwrite(data[s], elem[s], count[s], f) == count[s];
+        pos = h.offset[s] + count[s] * elem[s];
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str())) {
+        remove(tmp.c_str());
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+// read only mapping of a snapshot file, the view points into the mapping
+struct Snapshot {
+    Snapshot() = default;
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    ~Snapshot() { if (base) munmap(base, size); }
+
+    void *base = nullptr;
+    size_t size = 0;
+    uint64_t hash = 0;
+    SceneView view;
+};
+
+// map a snapshot, returns false if the file does not exist, is not a valid snapshot for this build,
+// or if expected_hash is not 0 and does not match (stale snapshot)
+inline bool open_snapshot(const std::string &path, Snapshot &snap, uint64_t expected_hash = 0) {
+    using namespace snapshot_format;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header))
+        base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const Header &h = *(const Header *)base;
+    const size_t elem[SECTIONS] = {sizeof(Material), 4, 4, 4, 4, 4, sizeof(BVHNode), sizeof(Plane), sizeof(Light)};
+    bool ok = !memcmp(h.magic, MAGIC, sizeof(MAGIC)) && h.version == SNAPSHOT_VERSION && h.layout == layout()
+        && h.file_size == uint64_t(st.st_size) && (!expected_hash || h.hash == expected_hash) && h.output[sizeof(h.output) - 1] == 0;
+    for (int s = 0; s < SECTIONS && ok; s++)
+        ok = h.offset[s] % 64 == 0 && h.offset[s] <= h.file_size && h.count[s] <= (h.file_size - h.offset[s]) / elem[s];
+    if (!ok) {
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    if (snap.base) munmap(snap.base, snap.size);
+    snap.base = base, snap.size = st.st_size, snap.hash = h.hash;
+    const char *p = (const char *)base;
+    SceneView &v = snap.view;
+    v.materials = {(const Material *)(p + h.offset[MATERIALS]), h.count[MATERIALS]};
+    v.cx = {(const float *)(p + h.offset[CX]), h.count[CX]};
+    v.cy = {(const float *)(p + h.offset[CY]), h.count[CY]};
+    v.cz = {(const float *)(p + h.offset[CZ]), h.count[CZ]};
+    v.radius = {(const float *)(p + h.offset[RADIUS]), h.count[RADIUS]};
+    v.material = {(const int *)(p + h.offset[MATERIAL]), h.count[MATERIAL]};
+    v.nodes = {(const BVHNode *)(p + h.offset[NODES]), h.count[NODES]};
+    v.planes = {(const Plane *)(p + h.offset[PLANES]), h.count[PLANES]};
+    v.lights = {(const Light *)(p + h.offset[LIGHTS]), h.count[LIGHTS]};
+    v.camera = h.camera;
+    v.settings.width = h.width, v.settings.height = h.height, v.settings.max_depth = h.max_depth;
+    v.settings.background = h.background;
+    v.settings.output = h.output;
+    return true;
+}
+
+#endif //__SNAPSHOT_H__
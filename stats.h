@@ -0,0 +1,63 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+#include <cstdint>
+#include <cstdio>
+
+// Tracing counters. Compiled in only when RT_STATS is defined, otherwise the RT_COUNT macros expand to
+// nothing and the tracer pays nothing. Each thread counts into its own thread local copy, render() adds
+// them up at the end.
+
+const int STATS_MAX_DEPTH = 16; // deeper recursion lands in the last bucket of the histogram
+
+struct alignas(64) TraceStats { // padded to whole cache lines, threads never share one
+    uint64_t primary = 0, reflection = 0, refraction = 0, shadow = 0;	// rays by type
+    uint64_t box_tests = 0, sphere_tests = 0, plane_tests = 0;			// intersection tests
+    uint64_t hits = 0, misses = 0;										// scene_intersect() results
+    uint64_t depth[STATS_MAX_DEPTH] = {};								// rays traced at each recursion depth
+
+    TraceStats &operator+=(const TraceStats &o) {
+        primary += o.primary, reflection += o.reflection, refraction += o.refraction, shadow += o.shadow;
+        box_tests += o.box_tests, sphere_tests += o.sphere_tests, plane_tests += o.plane_tests;
+        hits += o.hits, misses += o.misses;
+        for (int i = 0; i < STATS_MAX_DEPTH; i++) depth[i] += o.depth[i];
+        return *this;
+    }
+    uint64_t rays() const { return primary + reflection + refraction + shadow; }
+};
+
+#ifdef RT_STATS
+inline thread_local TraceStats thread_stats;
+#define RT_COUNT(counter) (thread_stats.counter++)
+#define RT_ADD(counter, n) (thread_stats.counter += (n))
+#define RT_COUNT_DEPTH(d) (thread_stats.depth[(d) < size_t(STATS_MAX_DEPTH) ? (d) : STATS_MAX_DEPTH - 1]++)
+#else
+#define RT_COUNT(counter) ((void)0)
+#define RT_ADD(counter, n) ((void)0)
+#define RT_COUNT_DEPTH(d) ((void)0)
+#endif
+
+inline void print_stats(FILE *f, const TraceStats &s) {
+    const unsigned long long tests = s.box_tests + s.sphere_tests + s.plane_tests;
+    fprintf(f, "rays        %14llu  primary %llu, reflection %llu, refraction %llu, shadow %llu\n", (unsigned long long)s.rays(),
+        (unsigned long long)s.primary, (unsigned long long)s.reflection, (unsigned long long)s.refraction, (unsigned long long)s.shadow);
+    fprintf(f, "tests       %14llu  box %llu, sphere %llu, plane %llu, %.1f per ray\n", tests, (unsigned long long)s.box_tests,
+        (unsigned long long)s.sphere_tests, (unsigned long long)s.plane_tests, s.rays() ? double(tests) / s.rays() : 0.);
+    fprintf(f, "intersect   %14llu  hits %llu, misses %llu\n", (unsigned long long)(s.hits + s.misses),
+        (unsigned long long)s.hits, (unsigned long long)s.misses);
+    fprintf(f, "depth      ");
+    for (int i = 0; i < STATS_MAX_DEPTH; i++)
+        if (s.depth[i]) fprintf(f, " %d: %llu", i, (unsigned long long)s.depth[i]);
+    fprintf(f, "\n");
+}
+
+inline void write_stats_json(FILE *f, const TraceStats &s) {
+    fprintf(f, "{\"rays\": {\"primary\": %llu, \"reflection\": %llu, \"refraction\": %llu, \"shadow\": %llu}, ",
+        (unsigned long long)s.primary, (unsigned long long)s.reflection, (unsigned long long)s.refraction, (unsigned long long)s.shadow);
+    fprintf(f, "\"tests\": {\"box\": %llu, \"sphere\": %llu, \"plane\": %llu}, \"hits\": %llu, \"misses\": %llu, \"depth\": [",
+        (unsigned long long)s.box_tests, (unsigned long long)s.sphere_tests, (unsigned long long)s.plane_tests,
+        (unsigned long long)s.hits, (unsigned long long)s.misses);
+    for (int i = 0; i < STATS_MAX_DEPTH; i++) fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)s.depth[i]);
+    fprintf(f, "]}\n");
+}
+
+#endif //__STATS_H__
@@ -0,0 +1,33 @@
+#!/bin/sh
+# usage: tests/golden.sh raytracer [--update]
+# renders every case of tests/golden/cases with raytracer and checks it with --compare against its golden image,
+# with the case's PSNR/SSIM thresholds and time budget. exits with status 1 if any case fails. --update writes
+# the images of this build as the golden ones instead (each golden once, from the first case using it)
+set -u
+dir=$(cd "$(dirname "$0")" && pwd)
+raytracer=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+update=${2:-}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+total=0
+while read -r name golden psnr ssim budget args; do
+    case "$name" in ''|'#'*) continue ;; esac
+    total=$((total + 1))
+    # the scenes write ./out.ppm, every case renders in the scratch directory
+    if [ "$update" = --update ]; then
+        [ -f "$work/$golden.done" ] && continue
+        (cd "$work" && "$raytracer" $args >/dev/null 2>&1) && cp "$work/out.ppm" "$dir/golden/$golden.ppm" && touch "$work/$golden.done" \
+            && echo "updated $golden from $name" || { echo "$name: render failed"; failed=$((failed + 1)); }
+        continue
+    fi
+    if (cd "$work" && "$raytracer" $args --compare "$dir/golden/$golden.ppm" --min-psnr "$psnr" --min-ssim "$ssim" --time-budget "$budget" >"$work/log" 2>&1); then
+        echo "ok    $name: $(tail -n 1 "$work/log")"
+    else
+        echo "FAIL  $name:"
+        sed 's/^/      /' "$work/log"
+        failed=$((failed + 1))
+    fi
+done < "$dir/golden/cases"
+echo "$((total - failed)) of $total cases passed"
+[ "$failed" = 0 ]
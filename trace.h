@@ -0,0 +1,76 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <omp.h>
+
+// Timeline of render phases exported in the Chrome trace event format (chrome://tracing, Perfetto). Events
+// go to a buffer per OpenMP thread, so recording takes no lock; when tracing is off a scope costs one branch.
+
+struct TraceEvent {
+    const char *name;		// static string
+    uint64_t begin, end;	// ns since the log was enabled
+    int64_t arg;			// tile index for tiles, -1 otherwise
+};
+
+struct TraceLog {
+    bool enabled = false;
+    std::chrono::steady_clock::time_point start;
+    std::vector<std::vector<TraceEvent>> threads;	// indexed by omp thread number
+
+    void enable() {
+        enabled = true;
+        start = std::chrono::steady_clock::now();
+        threads.assign(omp_get_max_threads(), {});
+        for (auto &t : threads) t.reserve(4096);
+    }
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    void add(const char *name, uint64_t begin, int64_t arg = -1) {
+        size_t t = omp_get_thread_num();
+        if (t < threads.size()) threads[t].push_back({name, begin, now(), arg});
+    }
+
+    // write all events as complete ("X") events, false if the file cannot be written
+    bool write(const char *path) const {
+        FILE *f = fopen(path, "w");
+        if (!f) return false;
+        fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        for (size_t t = 0; t < threads.size(); t++)
+            fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"%s %zu\"}},\n",
+                t, t ? "worker" : "main", t);
+        for (size_t t = 0; t < threads.size(); t++) {
+            for (const TraceEvent &e : threads[t]) {
+                fprintf(f, "{\"name\": \"%s\", \"cat\": \"render\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f",
+                    e.name, t, e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+                if (e.arg >= 0) fprintf(f, ", \"args\": {\"tile\": %lld}", (long long)e.arg);
+                fprintf(f, "},\n");
+            }
+        }
+        fprintf(f, "{\"name\": \"end\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f}\n]}\n", now() * 1e-3);
+        return fclose(f) == 0;
+    }
+};
+
+inline TraceLog trace_log;
+
+// records the lifetime of the scope as an event on the calling thread
+struct TraceScope {
+    TraceScope(const char *name, int64_t arg = -1) : name(name), arg(arg), begin(trace_log.enabled ? trace_log.now() : 0) {}
+    ~TraceScope() { end(); }
+
+    // record the event now instead of at the end of the scope
+    void end() {
+        if (trace_log.enabled && name) trace_log.add(name, begin, arg);
+        name = nullptr;
+    }
+
+    const char *name;
+    int64_t arg;
+    uint64_t begin;
+};
+
+#endif //__TRACE_H__
@@ -0,0 +1,20 @@
+#ifndef __TRACER_H__
+#define __TRACER_H__
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include "geometry.h"
+#include "accel.h"
+#include "stats.h"
+#include "incremental.h"
+
+// the tracing kernels compiled for the baseline instruction set, dispatch.h has the variants for newer ones.
+// each variant has a namespace of its own, or argument dependent lookup would find the global ones from inside
+// the others
+namespace isa_generic {
+#include "tracer.inc"
+}
+using namespace isa_generic;
+
+#endif //__TRACER_H__
@@ -0,0 +1,169 @@
+#ifndef __WIDE_H__
+#define __WIDE_H__
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include "geometry.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Structure of arrays vectors for math on several rays at once: vec3x<N> holds N vec3 as one register of x,
+// one of y and one of z, so every operation works on all lanes with one instruction per component. Built on
+// the GCC/Clang vector extensions, which compile to SSE, AVX, AVX-512 or NEON depending on the target.
+// Comparisons give masks with all bits set in the true lanes, which select() and the masked reductions take.
+
+#ifndef RT_LANES
+#if defined(__AVX__)
+#define RT_LANES 8	// one ymm register
+#else
+#define RT_LANES 4	// one xmm or NEON register
+#endif
+#endif
+
+template <int N> struct wide {
+    typedef float lanes __attribute__((vector_size(N * sizeof(float))));
+    typedef int32_t mask __attribute__((vector_size(N * sizeof(int32_t))));
+};
+
+template <int N> struct vec3x {
+    typedef typename wide<N>::lanes lanes;
+    typedef typename wide<N>::mask mask;
+    static const int size = N;
+
+    lanes x, y, z;
+
+    static vec3x splat(const vec3 &v) {
+        vec3x r;
+        r.x = lanes{} + v.x, r.y = lanes{} + v.y, r.z = lanes{} + v.z;
+        return r;
+    }
+    // gather from structure of arrays, x[0..N), y[0..N), z[0..N)
+    static vec3x load(const float *px, const float *py, const float *pz) {
+        vec3x r;
+        for (int i = 0; i < N; i++) r.x[i] = px[i], r.y[i] = py[i], r.z[i] = pz[i];
+        return r;
+    }
+    vec3 lane(int i) const { return vec3{x[i], y[i], z[i]}; }
+    void set_lane(int i, const vec3 &v) { x[i] = v.x, y[i] = v.y, z[i] = v.z; }
+};
+
+typedef vec3x<4> vec3x4;
+typedef vec3x<8> vec3x8;
+typedef vec3x<RT_LANES> vec3xl;	// the natural width of the target
+
+template <int N> inline vec3x<N> operator+(vec3x<N> a, const vec3x<N> &b) { a.x += b.x, a.y += b.y, a.z += b.z; return a; }
+template <int N> inline vec3x<N> operator-(vec3x<N> a, const vec3x<N> &b) { a.x -= b.x, a.y -= b.y, a.z -= b.z; return a; }
+template <int N> inline vec3x<N> operator-(vec3x<N> a) { a.x = -a.x, a.y = -a.y, a.z = -a.z; return a; }
+template <int N> inline vec3x<N> operator*(vec3x<N> a, const typename vec3x<N>::lanes s) { a.x *= s, a.y *= s, a.z *= s; return a; }
+template <int N> inline vec3x<N> operator*(vec3x<N> a, const float s) { a.x *= s, a.y *= s, a.z *= s; return a; }
+// dot product per lane, components added in the order of the scalar vec3 dot product
+template <int N> inline typename vec3x<N>::lanes operator*(const vec3x<N> &a, const vec3x<N> &b) {
+    return a.z * b.z + a.y * b.y + a.x * b.x;
+}
+template <int N> inline vec3x<N> cross(const vec3x<N> &a, const vec3x<N> &b) {
+    vec3x<N> r;
+    r.x = a.y * b.z - a.z * b.y, r.y = a.z * b.x - a.x * b.z, r.z = a.x * b.y - a.y * b.x;
+    return r;
+}
+
+// the vector extensions have no square root, and the compiler does not vectorize one lane at a time std::sqrt
+// because of errno
+template <typename V> inline V sqrt_lanes(V v) {
+#if defined(__SSE__)
+    if constexpr (sizeof(V) == 16) return (V)_mm_sqrt_ps((__m128)v);
+#endif
+#if defined(__AVX__)
+    if constexpr (sizeof(V) == 32) return (V)_mm256_sqrt_ps((__m256)v);
+#endif
+#if defined(__aarch64__)
+    if constexpr (sizeof(V) == 16) return (V)vsqrtq_f32((float32x4_t)v);
+#endif
+    for (unsigned i = 0; i < sizeof(V) / sizeof(float); i++) v[i] = std::sqrt(v[i]);
+    return v;
+}
+template <int N> inline typename vec3x<N>::lanes norm(const vec3x<N> &a) {
+    return sqrt_lanes(a.x * a.x + a.y * a.y + a.z * a.z);
+}
+template <int N> inline vec3x<N> normalize(const vec3x<N> &a, float l = 1) {
+    return a * (l / norm(a));
+}
+
+// lane wise m ? a : b
+template <typename V, typename M> inline V select(const M &m, const V &a, const V &b) { return m ? a : b; }
+template <int N, typename M> inline vec3x<N> select(const M &m, const vec3x<N> &a, const vec3x<N> &b) {
+    vec3x<N> r;
+    r.x = m ? a.x : b.x, r.y = m ? a.y : b.y, r.z = m ? a.z : b.z;
+    return r;
+}
+
+// one bit per lane, lane 0 in bit 0
+template <typename M> inline unsigned lane_bits(const M &m) {
+    unsigned b = 0;
+    for (unsigned i = 0; i < sizeof(M) / sizeof(int32_t); i++) b |= unsigned(m[i] != 0) << i;
+    return b;
+}
+template <typename M> inline bool any_lane(const M &m) { return lane_bits(m) != 0; }
+template <typename M> inline bool all_lanes(const M &m) { return lane_bits(m) == (1u << sizeof(M) / sizeof(int32_t)) - 1; }
+
+// smallest lane, and the first lane holding it. only the lanes in m take part, +inf and -1 if there are none
+template <typename V> inline float hmin(const V &v) {
+    float r = v[0];
+    for (unsigned i = 1; i < sizeof(V) / sizeof(float); i++) r = r < v[i] ? r : v[i];
+    return r;
+}
+template <typename V, typename M> inline float hmin(const V &v, const M &m) {
+    return hmin(select(m, v, V{} + std::numeric_limits<float>::infinity()));
+}
+template <typename V> inline int argmin(const V &v) {
+    int r = 0;
+    for (unsigned i = 1; i < sizeof(V) / sizeof(float); i++) if (v[i] < v[r]) r = int(i);
+    return r;
+}
+template <typename V, typename M> inline int argmin(const V &v, const M &m) {
+    return any_lane(m) ? argmin(select(m, v, V{} + std::numeric_limits<float>::infinity())) : -1;
+}
+
+// N rays against N spheres (splat one of them to test a ray against N spheres or N rays against one sphere),
+// the lane wise ray_sphere_intersect: the mask of the lanes that hit, with the distance in t0
+template <int N> inline typename vec3x<N>::mask ray_sphere_intersect(const vec3x<N> &orig, const vec3x<N> &dir,
+        const vec3x<N> &center, const typename vec3x<N>::lanes &radius, typename vec3x<N>::lanes &t0) {
+    typedef typename vec3x<N>::lanes lanes;
+    const vec3x<N> dist = center - orig;
+    const lanes proj = dist * dir;
+    const lanes d2 = dist * dist - proj * proj;
+    const lanes r2 = radius * radius;
+    const typename vec3x<N>::mask inside = d2 <= r2;
+    const lanes half_chord = sqrt_lanes(select(inside, r2 - d2, lanes{}));
+    const lanes t1 = proj + half_chord;
+    t0 = proj - half_chord;
+    t0 = select(t0 < .001f, t1, t0);	// the ray starts inside the sphere
+    return inside & (t0 >= .001f);
+}
+
+// lane wise reflect
+template <int N> inline vec3x<N> reflect(const vec3x<N> &I, const vec3x<N> &Nrm) {
+    return I - Nrm * 2.f * (I * Nrm);
+}
+
+// lane wise refract, with the refractive indices per lane
+template <int N> inline vec3x<N> refract(const vec3x<N> &I, const vec3x<N> &Nrm, const typename vec3x<N>::lanes &eta_t,
+        const typename vec3x<N>::lanes &eta_i) {
+    typedef typename vec3x<N>::lanes lanes;
+    lanes cosi = I * Nrm;
+    cosi = -select(cosi < -1.f, lanes{} - 1.f, select(cosi > 1.f, lanes{} + 1.f, cosi));
+    const typename vec3x<N>::mask inside = cosi < 0;	// the ray comes from inside the object, swap the media
+    const vec3x<N> n = select(inside, -Nrm, Nrm);
+    cosi = select(inside, -cosi, cosi);
+    const lanes eta = select(inside, eta_t / eta_i, eta_i / eta_t);
+    const lanes k = 1.f - eta * eta * (1.f - cosi * cosi);
+    const vec3x<N> r = I * eta + n * (eta * cosi - sqrt_lanes(select(k < 0, lanes{}, k)));
+    return select(k < 0, vec3x<N>::splat(vec3{1, 0, 0}), r);
+}
+template <int N> inline vec3x<N> refract(const vec3x<N> &I, const vec3x<N> &Nrm, const typename vec3x<N>::lanes &eta_t) {
+    return refract(I, Nrm, eta_t, typename vec3x<N>::lanes{} + 1.f);
+}
+
+#endif //__WIDE_H__